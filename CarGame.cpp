@@ -1,288 +1,5480 @@
 // CAR GAME:
 
 #include <iostream>
-#include <direct.h>
-#include <windows.h>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <string>
+#include <chrono>
 #include <time.h>
+#include <errno.h>
+#include <signal.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define COLLIDE_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
 #include <conio.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#endif
+
+#define CLASSIC_WIDTH 91
+#define CLASSIC_HEIGHT 26
+#define CLASSIC_LANES 9
+#define MAX_LANES 64
+#define MAX_ROWS 200
+#define WALL_WIDTH 17
+#define PANEL_WIDTH 20
+#define ROAD_SLACK 4
+#define ATTR_BLUE 1
+#define ATTR_GREEN 2
+#define ATTR_RED 4
+#define ATTR_BRIGHT 8
+#define DEFAULT_ATTR (ATTR_RED | ATTR_GREEN | ATTR_BLUE)
+#define RUN_GAP 4
+#define TICK_MS 50
+#define MAX_CATCHUP_STEPS 5
+#define INPUT_RING_SIZE 256
+#define ESC_TIMEOUT_MS 30
+#define KEY_ESC 27
+#define KEY_UP 0x101
+#define KEY_DOWN 0x102
+#define KEY_RIGHT 0x103
+#define KEY_LEFT 0x104
+#define KEY_EOF 0x1ff
+#define DEFAULT_TRAFFIC 2
+#define SPAWN_GAP 9
+#define LANE_BAND 8
+#define BUCKET_ROWS 4
+#define BROADPHASE_MIN 16
+#define HITBOX_W 5
+#define HITBOX_H 4
+#define CAR_STEP 4
+#define AUTOPILOT_HORIZON 32
+#define SPAWN_ROW 1
+#define FP_SHIFT 8
+#define FP_ONE (1 << FP_SHIFT)
+#define ENEMY_SPEED FP_ONE
+#define ENEMY_MAX_SPEED (2 * FP_ONE)
+#define SPEED_RAMP 4
+#define REPLAY_KEYFRAME_TICKS 1024
+#define REPLAY_SEEK_TICKS 200
+#define REWIND_TICKS 100
+#define REWIND_STEP_TICKS 20
+#define PRACTICE_REWIND_TICKS 40
+#define SCORES_KEPT 100
+#define SCORE_COMPACT_RECORDS 256
+#define LEADERBOARD_ROWS 5
+#define SESSION_BACKLOG_MAX 65536
+#define SERVER_EVENTS 256
+#define SERVER_REPORT_SECONDS 5
+#define BOT_KEY_TICKS 5
+#define CAST_RING_SIZE 64
+#define CAST_KEYFRAME_FRAMES 20
+
+using namespace std;
+
+typedef chrono::steady_clock SteadyClock;
+typedef SteadyClock::time_point SteadyTime;
+
+// TERMINAL BACKEND:
+// Screen output is ANSI/VT on every platform and leaves the process through
+// termWrite(). Only raw key input, sleeping and terminal mode setup differ.
+// termReadKey() returns plain characters or the decoded KEY_* codes, and
+// -1 on timeout or when another thread calls termWakeReader().
+
+// Set when the process comes back from a job-control stop; the screen is
+// no longer what we last drew.
+volatile sig_atomic_t termResumed = 0;
+
+#ifdef _WIN32
+
+HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+HANDLE inputWake = CreateEventA(NULL, FALSE, FALSE, NULL);
+DWORD savedConsoleMode;
+
+void termRestoreMode()
+{
+    SetConsoleMode(console, savedConsoleMode);
+}
+
+void termWrite(const char *data, size_t len)
+{
+    DWORD written;
+    WriteConsoleA(console, data, (DWORD)len, &written, NULL);
+}
+
+BOOL WINAPI onConsoleCtrl(DWORD type)
+{
+    (void)type;
+    termWrite("\x1b[0m\x1b[?25h", 10);
+    termRestoreMode();
+    return FALSE;
+}
+
+void termOpen()
+{
+    GetConsoleMode(console, &savedConsoleMode);
+    SetConsoleMode(console, savedConsoleMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+    SetConsoleCtrlHandler(onConsoleCtrl, TRUE);
+}
+
+// Extended keys come from _getch() as a 0 or 0xE0 prefix plus a scan code.
+int termDecodeKey()
+{
+    int c = _getch();
+    if (c != 0 && c != 0xE0)
+        return c;
+    switch (_getch())
+    {
+    case 72:
+        return KEY_UP;
+    case 80:
+        return KEY_DOWN;
+    case 77:
+        return KEY_RIGHT;
+    case 75:
+        return KEY_LEFT;
+    }
+    return -1;
+}
+
+int termReadKey(int timeoutMs)
+{
+    static HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+    HANDLE handles[2] = {input, inputWake};
+
+    while (!_kbhit())
+    {
+        if (WaitForMultipleObjects(2, handles, FALSE, timeoutMs < 0 ? INFINITE : (DWORD)timeoutMs) != WAIT_OBJECT_0)
+            return -1;
+
+        // The console also signals focus, mouse and key-up events; drop
+        // one so the wait does not spin on it.
+        if (!_kbhit())
+        {
+            INPUT_RECORD rec;
+            DWORD n = 0;
+            ReadConsoleInputA(input, &rec, 1, &n);
+        }
+    }
+    return termDecodeKey();
+}
+
+void termWakeReader()
+{
+    SetEvent(inputWake);
+}
+
+// Size of the visible window in cells; false if there is no console.
+bool termSize(int &cols, int &rows)
+{
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (!GetConsoleScreenBufferInfo(console, &info))
+        return false;
+    cols = info.srWindow.Right - info.srWindow.Left + 1;
+    rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+    return cols > 0 && rows > 0;
+}
+
+// The console has no resize signal, so compare with the last size seen.
+bool termTakeResize()
+{
+    static int lastCols = -1, lastRows = -1;
+    int cols = 0, rows = 0;
+    termSize(cols, rows);
+    bool changed = lastCols >= 0 && (cols != lastCols || rows != lastRows);
+    lastCols = cols;
+    lastRows = rows;
+    return changed;
+}
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// Sleep() rounds up to the scheduler quantum (often 15.6 ms), so wait on a
+// high resolution timer and spin off the last millisecond.
+void termSleepUntil(SteadyTime deadline)
+{
+    static HANDLE timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+
+    SteadyClock::duration left = deadline - SteadyClock::now() - chrono::milliseconds(1);
+    if (timer != NULL && left > SteadyClock::duration::zero())
+    {
+        LARGE_INTEGER due;
+        due.QuadPart = -(LONGLONG)(chrono::duration_cast<chrono::nanoseconds>(left).count() / 100);
+        if (SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE))
+            WaitForSingleObject(timer, INFINITE);
+    }
+    while (SteadyClock::now() < deadline)
+        SwitchToThread();
+}
+
+#else
+
+struct termios savedTermios;
+bool termiosSaved = false;
+volatile sig_atomic_t termResized = 0;
+int wakePipe[2] = {-1, -1};
+int pushedKey = -1;
+
+// Non-canonical, no echo. Output post-processing and ISIG stay on, so "\n"
+// still returns the carriage and Ctrl-C reaches onFatalSignal().
+void termEnterRaw()
+{
+    struct termios raw = savedTermios;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+}
+
+void termRestoreMode()
+{
+    if (termiosSaved)
+        tcsetattr(STDIN_FILENO, TCSANOW, &savedTermios);
+}
+
+// Only async-signal-safe calls: write() and tcsetattr().
+void termEmergencyRestore()
+{
+    static const char reset[] = "\x1b[0m\x1b[?25h";
+    ssize_t ignored = write(STDOUT_FILENO, reset, sizeof(reset) - 1);
+    (void)ignored;
+    termRestoreMode();
+}
+
+void installHandler(int sig, void (*handler)(int))
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(sig, &sa, NULL);
+}
+
+void onFatalSignal(int sig)
+{
+    termEmergencyRestore();
+    installHandler(sig, SIG_DFL);
+    raise(sig);
+}
+
+void onSuspendResume(int sig)
+{
+    if (sig == SIGTSTP)
+    {
+        // Hand the shell a sane terminal, then stop for real once we return.
+        termEmergencyRestore();
+        installHandler(SIGTSTP, SIG_DFL);
+        raise(SIGTSTP);
+    }
+    else
+    {
+        if (termiosSaved)
+            termEnterRaw();
+        installHandler(SIGTSTP, onSuspendResume);
+        termResumed = 1;
+    }
+}
+
+void onResize(int)
+{
+    termResized = 1;
+}
+
+void termOpen()
+{
+    if (tcgetattr(STDIN_FILENO, &savedTermios) == 0)
+    {
+        termiosSaved = true;
+        termEnterRaw();
+    }
+
+    if (pipe(wakePipe) == 0)
+    {
+        fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+    }
+
+    installHandler(SIGINT, onFatalSignal);
+    installHandler(SIGTERM, onFatalSignal);
+    installHandler(SIGHUP, onFatalSignal);
+    installHandler(SIGQUIT, onFatalSignal);
+    installHandler(SIGTSTP, onSuspendResume);
+    installHandler(SIGCONT, onSuspendResume);
+    installHandler(SIGWINCH, onResize);
+}
+
+void termWrite(const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(STDOUT_FILENO, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+int termGetch()
+{
+    unsigned char c;
+    for (;;)
+    {
+        ssize_t n = read(STDIN_FILENO, &c, 1);
+        if (n == 1)
+            return c;
+        if (n == 0 || errno != EINTR)
+            return -1;
+    }
+}
+
+// Sleeps in poll() until stdin is readable (true), or the timeout passes,
+// a signal arrives or termWakeReader() is called (false). A negative
+// timeout waits forever.
+bool termWaitReadable(int timeoutMs)
+{
+    struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {wakePipe[0], POLLIN, 0}};
+    if (poll(fds, 2, timeoutMs) <= 0)
+        return false;
+    if (fds[1].revents & POLLIN)
+    {
+        char drain[16];
+        while (read(wakePipe[0], drain, sizeof(drain)) > 0)
+            ;
+        return false;
+    }
+    return (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+}
+
+int termReadKey(int timeoutMs)
+{
+    if (pushedKey >= 0)
+    {
+        int key = pushedKey;
+        pushedKey = -1;
+        return key;
+    }
+
+    if (!termWaitReadable(timeoutMs))
+        return -1;
+    int c = termGetch();
+    if (c < 0)
+        return KEY_EOF;
+    if (c != KEY_ESC)
+        return c;
+
+    // An escape sequence arrives in one burst; a lone ESC does not.
+    if (!termWaitReadable(ESC_TIMEOUT_MS))
+        return KEY_ESC;
+    int c2 = termGetch();
+    if (c2 != '[' && c2 != 'O')
+    {
+        // Also keeps an end of input that came right after the ESC.
+        pushedKey = c2 < 0 ? KEY_EOF : c2;
+        return KEY_ESC;
+    }
+
+    // Skip parameter and intermediate bytes up to the final byte.
+    int final;
+    do
+    {
+        if (!termWaitReadable(ESC_TIMEOUT_MS))
+            return -1;
+        final = termGetch();
+    } while (final >= 0x20 && final < 0x40);
+
+    switch (final)
+    {
+    case -1:
+        return KEY_EOF;
+    case 'A':
+        return KEY_UP;
+    case 'B':
+        return KEY_DOWN;
+    case 'C':
+        return KEY_RIGHT;
+    case 'D':
+        return KEY_LEFT;
+    }
+    return -1;
+}
+
+void termWakeReader()
+{
+    char c = 1;
+    ssize_t ignored = write(wakePipe[1], &c, 1);
+    (void)ignored;
+}
+
+// Size of the terminal in cells; false if stdout is not a terminal.
+bool termSize(int &cols, int &rows)
+{
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0 || ws.ws_col == 0 || ws.ws_row == 0)
+        return false;
+    cols = ws.ws_col;
+    rows = ws.ws_row;
+    return true;
+}
+
+// True once after each SIGWINCH.
+bool termTakeResize()
+{
+    if (!termResized)
+        return false;
+    termResized = 0;
+    return true;
+}
+
+// steady_clock is CLOCK_MONOTONIC here, so its epoch can be handed to
+// clock_nanosleep as an absolute deadline that does not drift.
+void termSleepUntil(SteadyTime deadline)
+{
+    chrono::nanoseconds ns = chrono::duration_cast<chrono::nanoseconds>(deadline.time_since_epoch());
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ns.count() / 1000000000LL);
+    ts.tv_nsec = (long)(ns.count() % 1000000000LL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+#endif
+
+// Menu screens print through cout; that text must reach the terminal
+// before a raw frame write or before we block waiting for a key.
+void flushOutput()
+{
+    cout.flush();
+}
+
+void termClose()
+{
+    cout << "\x1b[0m\x1b[?25h";
+    flushOutput();
+    termRestoreMode();
+}
+
+// Blocks until a key arrives. The game cannot go on without a terminal,
+// so end-of-file on stdin ends the program.
+int readKey()
+{
+    flushOutput();
+    for (;;)
+    {
+        int key = termReadKey(-1);
+        if (key == KEY_EOF)
+            exit(0);
+        if (key >= 0)
+            return key;
+    }
+}
+
+int readKeyEcho()
+{
+    int c = readKey();
+    if (c >= 32 && c < 127)
+    {
+        cout << (char)c;
+        flushOutput();
+    }
+    return c;
+}
+
+void sleepUntil(SteadyTime deadline)
+{
+    flushOutput();
+    termSleepUntil(deadline);
+}
+
+// FILES:
+// Read-only views of whole files, where pages load on first touch so
+// opening a long recording costs nothing until a part of it is read, and
+// the few durability primitives the score store needs: sync to disk,
+// truncate, advisory locks and atomic replace. makeTempDir() gives the
+// self-test a private directory for its scratch files.
+
+struct MappedFile
+{
+    const uint8_t *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+#ifdef _WIN32
+
+bool mapFile(const char *path, MappedFile &m)
+{
+    LARGE_INTEGER size;
+    m.data = NULL;
+    m.mapping = NULL;
+    m.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m.file == INVALID_HANDLE_VALUE)
+        return false;
+    if (GetFileSizeEx(m.file, &size) && size.QuadPart > 0)
+    {
+        m.size = (size_t)size.QuadPart;
+        m.mapping = CreateFileMappingA(m.file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (m.mapping != NULL)
+            m.data = (const uint8_t *)MapViewOfFile(m.mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (m.data == NULL)
+    {
+        if (m.mapping != NULL)
+            CloseHandle(m.mapping);
+        CloseHandle(m.file);
+        return false;
+    }
+    return true;
+}
+
+void unmapFile(MappedFile &m)
+{
+    UnmapViewOfFile(m.data);
+    CloseHandle(m.mapping);
+    CloseHandle(m.file);
+    m.data = NULL;
+}
+
+bool syncFile(FILE *f)
+{
+    return fflush(f) == 0 && _commit(_fileno(f)) == 0;
+}
+
+bool truncateFile(FILE *f, long long size)
+{
+    return fflush(f) == 0 && _chsize_s(_fileno(f), size) == 0;
+}
+
+bool lockFile(FILE *f, bool exclusive, bool wait)
+{
+    OVERLAPPED ov = {0};
+    DWORD flags = (exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0) | (wait ? 0 : LOCKFILE_FAIL_IMMEDIATELY);
+    return LockFileEx((HANDLE)_get_osfhandle(_fileno(f)), flags, 0, MAXDWORD, MAXDWORD, &ov) != 0;
+}
+
+void unlockFile(FILE *f)
+{
+    OVERLAPPED ov = {0};
+    UnlockFileEx((HANDLE)_get_osfhandle(_fileno(f)), 0, MAXDWORD, MAXDWORD, &ov);
+}
+
+bool replaceFile(const char *from, const char *to)
+{
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+
+// Returns the new directory's path, or "" if none could be created.
+string makeTempDir()
+{
+    char base[MAX_PATH];
+    DWORD n = GetTempPathA(MAX_PATH, base);
+    if (n == 0 || n >= MAX_PATH)
+        return "";
+    for (int attempt = 0; attempt < 100; attempt++)
+    {
+        string path = string(base) + "cargame-" + to_string(GetCurrentProcessId()) + "-" + to_string(attempt);
+        if (CreateDirectoryA(path.c_str(), NULL))
+            return path;
+        if (GetLastError() != ERROR_ALREADY_EXISTS)
+            return "";
+    }
+    return "";
+}
+
+void removeDir(const string &path)
+{
+    RemoveDirectoryA(path.c_str());
+}
+
+#else
+
+bool mapFile(const char *path, MappedFile &m)
+{
+    m.data = NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void *view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view != MAP_FAILED)
+        {
+            m.data = (const uint8_t *)view;
+            m.size = (size_t)st.st_size;
+        }
+    }
+    close(fd);
+    return m.data != NULL;
+}
+
+void unmapFile(MappedFile &m)
+{
+    munmap((void *)m.data, m.size);
+    m.data = NULL;
+}
+
+bool syncFile(FILE *f)
+{
+    return fflush(f) == 0 && fsync(fileno(f)) == 0;
+}
+
+bool truncateFile(FILE *f, long long size)
+{
+    return fflush(f) == 0 && ftruncate(fileno(f), (off_t)size) == 0;
+}
+
+bool lockFile(FILE *f, bool exclusive, bool wait)
+{
+    int op = (exclusive ? LOCK_EX : LOCK_SH) | (wait ? 0 : LOCK_NB);
+    while (flock(fileno(f), op) != 0)
+    {
+        if (errno != EINTR)
+            return false;
+    }
+    return true;
+}
+
+void unlockFile(FILE *f)
+{
+    flock(fileno(f), LOCK_UN);
+}
+
+// rename() is atomic; syncing the directory makes the new name durable.
+bool replaceFile(const char *from, const char *to)
+{
+    if (rename(from, to) != 0)
+        return false;
+    string dir = to;
+    size_t slash = dir.rfind('/');
+    dir = slash == string::npos ? "." : slash == 0 ? "/" : dir.substr(0, slash);
+    int fd = open(dir.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+    return true;
+}
+
+// Returns the new directory's path, or "" if none could be created.
+string makeTempDir()
+{
+    const char *base = getenv("TMPDIR");
+    string path = string(base != NULL && base[0] != '\0' ? base : "/tmp") + "/cargame-XXXXXX";
+    if (mkdtemp(&path[0]) == NULL)
+        return "";
+    return path;
+}
+
+void removeDir(const string &path)
+{
+    rmdir(path.c_str());
+}
+
+#endif
+
+// INPUT THREAD:
+// While a game runs, a dedicated thread blocks on the keyboard and pushes
+// each key, stamped with the time it was read, into a single-producer /
+// single-consumer ring. The game loop drains the ring and is woken as soon
+// as a key lands, so a move is shown without waiting for the next tick.
+
+struct KeyEvent
+{
+    int key;
+    SteadyTime time;
+};
+
+template <typename T, int N>
+struct SpscRing
+{
+    T slots[N];
+    alignas(64) atomic<uint32_t> head; // written by the producer only
+    alignas(64) atomic<uint32_t> tail; // written by the consumer only
+
+    bool push(const T &v)
+    {
+        uint32_t h = head.load(memory_order_relaxed);
+        if (h - tail.load(memory_order_acquire) == N)
+            return false;
+        slots[h % N] = v;
+        head.store(h + 1, memory_order_release);
+        return true;
+    }
+
+    bool pop(T &v)
+    {
+        uint32_t t = tail.load(memory_order_relaxed);
+        if (t == head.load(memory_order_acquire))
+            return false;
+        v = slots[t % N];
+        tail.store(t + 1, memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return tail.load(memory_order_acquire) == head.load(memory_order_acquire);
+    }
+};
+
+SpscRing<KeyEvent, INPUT_RING_SIZE> inputRing;
+atomic<bool> inputRunning(false);
+thread inputThread;
+mutex inputMutex;
+condition_variable inputReady;
+
+void inputThreadMain()
+{
+    while (inputRunning.load(memory_order_acquire))
+    {
+        int key = termReadKey(-1);
+        if (key < 0)
+            continue;
+        if (key == KEY_EOF)
+        {
+            // The terminal is gone: quit the game and stop reading.
+            key = KEY_ESC;
+            inputRunning.store(false, memory_order_release);
+        }
+
+        KeyEvent ev = {key, SteadyClock::now()};
+        inputRing.push(ev);
+        {
+            // Taking the lock orders the push before a waiter's check.
+            lock_guard<mutex> lock(inputMutex);
+        }
+        inputReady.notify_one();
+    }
+}
+
+void startInput()
+{
+    flushOutput();
+    KeyEvent stale;
+    while (inputRing.pop(stale))
+        ;
+    inputRunning.store(true, memory_order_release);
+    inputThread = thread(inputThreadMain);
+}
+
+void stopInput()
+{
+    inputRunning.store(false, memory_order_release);
+    termWakeReader();
+    if (inputThread.joinable())
+        inputThread.join();
+}
+
+// Sleeps until the deadline or until a key arrives, whichever is first.
+// Returns true if woken by a key.
+bool waitInputUntil(SteadyTime deadline)
+{
+    {
+        unique_lock<mutex> lock(inputMutex);
+        if (inputReady.wait_until(lock, deadline, [] { return !inputRing.empty(); }))
+            return true;
+    }
+    sleepUntil(deadline);
+    return false;
+}
+
+void clearScreen()
+{
+    cout << "\x1b[0m\x1b[2J\x1b[H";
+}
+
+// LAYOUT:
+// The road is sized from the terminal when a game starts: every CAR_STEP
+// columns beyond the classic 91 add a lane, and every row beyond 26 adds a
+// row of road above the car. Nothing smaller than the classic layout is
+// offered. Left to right the screen is
+//
+//   left wall | road | right wall | side panel
+//
+// where the road is the spawn columns plus ROAD_SLACK, so a car in the
+// last column still fits. The Road is part of a game's rules and travels
+// with its GameState and replay; the Layout only says where things are
+// drawn, and is worked out again when the terminal is resized.
+
+struct Road
+{
+    int left;    // first spawn column
+    int columns; // spawn columns
+    int lanes;   // car positions, CAR_STEP apart from left + 1
+    int carRow;  // top row of the player's car; enemies below it have passed
+};
+
+Road roadWith(int lanes, int carRow)
+{
+    Road r = {WALL_WIDTH, 1 + (lanes - 1) * CAR_STEP, lanes, carRow};
+    return r;
+}
+
+Road roadFor(int cols, int rows)
+{
+    int lanes = min(CLASSIC_LANES + max(0, cols - CLASSIC_WIDTH) / CAR_STEP, MAX_LANES);
+    int height = min(max(rows, CLASSIC_HEIGHT), MAX_ROWS);
+    return roadWith(lanes, height - HITBOX_H);
+}
+
+// Headless games, benchmarks and network sessions all use this one.
+const Road classicRoad = roadFor(0, 0);
+
+int roadCarMin(const Road &r)
+{
+    return r.left + 1;
+}
+
+int roadCarMax(const Road &r)
+{
+    return r.left + r.columns;
+}
+
+int laneX(const Road &r, int lane)
+{
+    return roadCarMin(r) + lane * CAR_STEP;
+}
+
+struct Layout
+{
+    Road road;
+    int width;     // frame columns, the right border included
+    int height;    // frame rows
+    int wallRight; // first column of the right wall
+    int panel;     // last column of the right wall; panel text is placed from here
+};
+
+// Lays out `road`; the frame is clipped to a terminal of cols x rows if
+// that is smaller (0 means unknown).
+Layout layoutFor(const Road &road, int cols, int rows)
+{
+    Layout l;
+    l.road = road;
+    l.wallRight = road.left + road.columns + ROAD_SLACK;
+    l.panel = l.wallRight + WALL_WIDTH - 1;
+    l.width = l.panel + PANEL_WIDTH + 1;
+    l.height = road.carRow + HITBOX_H;
+    if (cols > 0)
+        l.width = min(l.width, cols);
+    if (rows > 0)
+        l.height = min(l.height, rows);
+    return l;
+}
+
+Layout layout = layoutFor(classicRoad, 0, 0);
+
+// Off-screen frame: every draw function writes here and presentFrame()
+// sends only the cells that differ from what the terminal already shows.
+// Cells are stored row by row; ch(y) and attr(y) point at row y.
+struct FrameBuffer
+{
+    int width;
+    int height;
+    vector<char> chars;
+    vector<unsigned char> attrs;
+
+    char *ch(int y) { return &chars[(size_t)y * width]; }
+    unsigned char *attr(int y) { return &attrs[(size_t)y * width]; }
+    const char *ch(int y) const { return &chars[(size_t)y * width]; }
+    const unsigned char *attr(int y) const { return &attrs[(size_t)y * width]; }
+};
+
+// Cells inside both the old and the new size are kept; new ones are blank.
+void frameResize(FrameBuffer &f, int width, int height)
+{
+    if (f.width == width && f.height == height)
+        return;
+    vector<char> chars((size_t)width * height, ' ');
+    vector<unsigned char> attrs((size_t)width * height, DEFAULT_ATTR);
+    for (int y = 0; y < min(height, f.height); y++)
+    {
+        memcpy(&chars[(size_t)y * width], f.ch(y), min(width, f.width));
+        memcpy(&attrs[(size_t)y * width], f.attr(y), min(width, f.width));
+    }
+    f.width = width;
+    f.height = height;
+    f.chars.swap(chars);
+    f.attrs.swap(attrs);
+}
+
+struct FrameStats
+{
+    long long bytesWritten;
+    long long cellsChanged;
+};
+
+// What one viewer's terminal shows and the bytes to send it next. The
+// local terminal is `screen`; every network session has its own.
+struct FrameEncoder
+{
+    FrameBuffer shown;
+    int shownAttr;
+    string out;
+    FrameStats stats;
+    FrameStats total;
+};
+
+// Frames are composed per thread, so server workers can draw sessions
+// side by side and encode each against its own FrameEncoder.
+thread_local FrameBuffer frame;
+FrameEncoder screen;
+
+void gotoxy(int x, int y)
+{
+    cout << "\x1b[" << y + 1 << ';' << x + 1 << 'H';
+}
+
+void setcursor(bool visible)
+{
+    cout << (visible ? "\x1b[?25h" : "\x1b[?25l");
+}
+
+void clearFrame()
+{
+    frameResize(frame, layout.width, layout.height);
+    memset(frame.chars.data(), ' ', frame.chars.size());
+    memset(frame.attrs.data(), DEFAULT_ATTR, frame.attrs.size());
+}
+
+void putChar(int x, int y, char c)
+{
+    if (x >= 0 && x < frame.width && y >= 0 && y < frame.height)
+        frame.ch(y)[x] = c;
+}
+
+void putText(int x, int y, const char *text)
+{
+    for (; *text; text++, x++)
+        putChar(x, y, *text);
+}
+
+// Call after the console has been cleared: the terminal now shows blanks,
+// so the next present only has to send the non-blank cells.
+void invalidateFrame(FrameEncoder &e = screen)
+{
+    frameResize(e.shown, layout.width, layout.height);
+    memset(e.shown.chars.data(), ' ', e.shown.chars.size());
+    memset(e.shown.attrs.data(), DEFAULT_ATTR, e.shown.attrs.size());
+    e.shownAttr = -1;
+}
+
+bool cellChanged(const FrameEncoder &e, int y, int x)
+{
+    return frame.ch(y)[x] != e.shown.ch(y)[x] || frame.attr(y)[x] != e.shown.attr(y)[x];
+}
+
+void emitAttr(FrameEncoder &e, unsigned char attr)
+{
+    e.shownAttr = attr;
+    // The default attribute is the terminal's own colours, not white.
+    if (attr == DEFAULT_ATTR)
+    {
+        e.out += "\x1b[0m";
+        return;
+    }
+    // console attribute bits are BGR, ANSI colour numbers are RGB
+    static const int ansiColor[8] = {0, 4, 2, 6, 1, 5, 3, 7};
+    char seq[16];
+    int fg = ansiColor[attr & 7] + ((attr & ATTR_BRIGHT) ? 90 : 30);
+    int len = snprintf(seq, sizeof(seq), "\x1b[0;%dm", fg);
+    e.out.append(seq, len);
+}
+
+// Diffs the frame against what the viewer shows and leaves the bytes to
+// send in e.out, without writing them anywhere.
+void encodeFrame(FrameEncoder &e = screen)
+{
+    const int width = frame.width;
+    e.out.clear();
+    e.stats.cellsChanged = 0;
+
+    // A terminal that grew still shows what it did inside the old size and
+    // blanks outside it, which is what the resize leaves in shown. (One
+    // that shrank may have rewrapped, so callers repaint it instead.)
+    frameResize(e.shown, width, frame.height);
+
+    for (int i = 0; i < frame.height; i++)
+    {
+        // Most rows do not change from one frame to the next.
+        if (memcmp(frame.ch(i), e.shown.ch(i), width) == 0 && memcmp(frame.attr(i), e.shown.attr(i), width) == 0)
+            continue;
+
+        int j = 0;
+        while (j < width)
+        {
+            if (!cellChanged(e, i, j))
+            {
+                j++;
+                continue;
+            }
+
+            // Extend the run across short stretches of unchanged cells;
+            // rewriting a few cells is cheaper than another cursor move.
+            int last = j;
+            for (int k = j + 1; k < width && k - last <= RUN_GAP; k++)
+            {
+                if (cellChanged(e, i, k))
+                    last = k;
+            }
+
+            char seq[16];
+            int len = snprintf(seq, sizeof(seq), "\x1b[%d;%dH", i + 1, j + 1);
+            e.out.append(seq, len);
+
+            for (; j <= last; j++)
+            {
+                if (cellChanged(e, i, j))
+                    e.stats.cellsChanged++;
+                if (frame.attr(i)[j] != e.shownAttr)
+                    emitAttr(e, frame.attr(i)[j]);
+                e.out += frame.ch(i)[j];
+                e.shown.ch(i)[j] = frame.ch(i)[j];
+                e.shown.attr(i)[j] = frame.attr(i)[j];
+            }
+        }
+    }
+
+    e.stats.bytesWritten = e.out.size();
+    e.total.bytesWritten += e.stats.bytesWritten;
+    e.total.cellsChanged += e.stats.cellsChanged;
+}
+
+void presentFrame()
+{
+    encodeFrame();
+    if (!screen.out.empty())
+    {
+        flushOutput();
+        termWrite(screen.out.data(), screen.out.size());
+    }
+}
+
+void drawBorder()
+{
+    for (int i = 0; i < frame.height; i++)
+    {
+        for (int j = 0; j < frame.width; j++)
+        {
+            if (j < layout.road.left || (j >= layout.wallRight && j <= layout.panel) || j == layout.panel + PANEL_WIDTH)
+                frame.ch(i)[j] = '+';
+        }
+    }
+}
+
+// The walls, the side panel titles and the key hints never change during
+// a game. They are drawn once into this layer, and every frame starts as a
+// straight copy of it, so nothing on the road needs erasing.
+FrameBuffer background;
+bool backgroundReady = false;
+
+void buildBackground()
+{
+    clearFrame();
+    drawBorder();
+    putText(layout.panel + 7, 2, "CAR GAME");
+    putText(layout.panel + 6, 4, "----------");
+    putText(layout.panel + 7, 12, "Control ");
+    putText(layout.panel + 7, 13, "--------- ");
+    putText(layout.panel + 2, 14, " A key - Left");
+    putText(layout.panel + 2, 15, " D key - Right");
+    putText(layout.panel + 2, 16, " R key - Rewind");
+    background = frame;
+    backgroundReady = true;
+}
+
+// Switches the screen to a new layout. The background is rebuilt; what is
+// on the terminal is left for the next present to diff against.
+void setLayout(const Layout &l)
+{
+    layout = l;
+    buildBackground();
+}
+
+void restoreBackground()
+{
+    if (!backgroundReady)
+        buildBackground();
+    frameResize(frame, background.width, background.height);
+    memcpy(frame.chars.data(), background.chars.data(), frame.chars.size());
+    memcpy(frame.attrs.data(), background.attrs.data(), frame.attrs.size());
+}
+
+// RANDOM NUMBERS:
+// PCG32: every game owns its generator, so a seed fully determines a run
+// and independent games never share hidden libc state.
+
+struct Rng
+{
+    uint64_t state;
+    uint64_t inc;
+};
+
+uint32_t rngNext(Rng &r)
+{
+    uint64_t old = r.state;
+    r.state = old * 6364136223846793005ULL + r.inc;
+    uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rot = (uint32_t)(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((0u - rot) & 31));
+}
+
+void rngSeed(Rng &r, uint64_t seed)
+{
+    r.state = 0;
+    r.inc = (0xda3e39cb94b95bdbULL << 1) | 1;
+    rngNext(r);
+    r.state += seed;
+    rngNext(r);
+}
+
+// Uniform in [0, bound) without modulo bias (Lemire's multiply-shift).
+uint32_t rngBounded(Rng &r, uint32_t bound)
+{
+    uint64_t m = (uint64_t)rngNext(r) * bound;
+    uint32_t low = (uint32_t)m;
+    if (low < bound)
+    {
+        uint32_t threshold = (0u - bound) % bound;
+        while (low < threshold)
+        {
+            m = (uint64_t)rngNext(r) * bound;
+            low = (uint32_t)m;
+        }
+    }
+    return (uint32_t)(m >> 32);
+}
+
+// SplitMix64 finaliser: spreads neighbouring inputs over the whole range.
+uint64_t mixSeed(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+uint64_t freshSeed()
+{
+    return mixSeed((uint64_t)time(NULL) ^ (uint64_t)SteadyClock::now().time_since_epoch().count());
+}
+
+// PROFILING:
+// Per-phase frame timings go into log-linear (HDR style) histograms: 16
+// linear sub-buckets per power of two keeps every bucket within ~6% of the
+// recorded value at a fixed 5 KB per phase. Scopes cost one branch while
+// the profiler is disabled, which is the default for headless runs.
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((44 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+enum Phase
+{
+    PHASE_INPUT,
+    PHASE_UPDATE,
+    PHASE_COLLISION,
+    PHASE_RENDER,
+    PHASE_SLEEP,
+    PHASE_FRAME,
+    PHASE_LATENCY,
+    PHASE_COUNT
+};
+
+const char *phaseNames[PHASE_COUNT] = {"in", "sim", "col", "draw", "idle", "frm", "lat"};
+
+struct Histogram
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t maxValue;
+};
+
+struct Profiler
+{
+    bool enabled;
+    Histogram phases[PHASE_COUNT];
+};
+
+Profiler profiler;
+
+int highBit(uint64_t v)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, v);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(v);
+#endif
+}
+
+int lowBit(uint32_t v)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, v);
+    return (int)index;
+#else
+    return __builtin_ctz(v);
+#endif
+}
+
+int histIndex(uint64_t v)
+{
+    if (v < HIST_SUB_COUNT)
+        return (int)v;
+    int shift = highBit(v) - HIST_SUB_BITS;
+    int index = ((shift + 1) << HIST_SUB_BITS) + (int)((v >> shift) & (HIST_SUB_COUNT - 1));
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+// Highest value that falls into the bucket, as HDR histograms report it.
+uint64_t histBucketValue(int index)
+{
+    if (index < HIST_SUB_COUNT)
+        return index;
+    int shift = (index >> HIST_SUB_BITS) - 1;
+    uint64_t sub = HIST_SUB_COUNT + (index & (HIST_SUB_COUNT - 1));
+    return ((sub + 1) << shift) - 1;
+}
+
+void histRecord(Histogram &h, uint64_t v)
+{
+    h.counts[histIndex(v)]++;
+    h.total++;
+    if (v > h.maxValue)
+        h.maxValue = v;
+}
+
+uint64_t histPercentile(const Histogram &h, double pct)
+{
+    if (h.total == 0)
+        return 0;
+    uint64_t want = (uint64_t)ceil(h.total * pct / 100.0);
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h.counts[i];
+        if (seen >= want && seen > 0)
+            return min(histBucketValue(i), h.maxValue);
+    }
+    return h.maxValue;
+}
+
+struct PhaseScope
+{
+    Phase phase;
+    SteadyTime start;
+
+    PhaseScope(Phase p) : phase(p)
+    {
+        if (profiler.enabled)
+            start = SteadyClock::now();
+    }
+
+    ~PhaseScope()
+    {
+        if (profiler.enabled)
+            histRecord(profiler.phases[phase], chrono::duration_cast<chrono::nanoseconds>(SteadyClock::now() - start).count());
+    }
+};
+
+// Formats nanoseconds in at most five characters for the side panel.
+void formatDuration(char *out, size_t size, uint64_t ns)
+{
+    if (ns < 1000)
+        snprintf(out, size, "%dn", (int)ns);
+    else if (ns < 10000)
+        snprintf(out, size, "%.1fu", ns / 1e3);
+    else if (ns < 1000000)
+        snprintf(out, size, "%du", (int)(ns / 1000));
+    else if (ns < 10000000)
+        snprintf(out, size, "%.1fm", ns / 1e6);
+    else
+        snprintf(out, size, "%dm", (int)(ns / 1000000));
+}
+
+void dumpProfile()
+{
+    fprintf(stderr, "%-6s %10s %10s %10s %10s\n", "phase", "count", "p50(us)", "p99(us)", "max(us)");
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        const Histogram &h = profiler.phases[i];
+        fprintf(stderr, "%-6s %10llu %10.1f %10.1f %10.1f\n", phaseNames[i], (unsigned long long)h.total,
+                histPercentile(h, 50) / 1e3, histPercentile(h, 99) / 1e3, h.maxValue / 1e3);
+    }
+    fprintf(stderr, "output: %lld bytes, %lld cells changed\n", screen.total.bytesWritten, screen.total.cellsChanged);
+}
+
+// GAME RULES:
+// The simulation core below does no I/O and never sleeps; play() is only a
+// driver that feeds it keys and draws the result. step() can therefore run
+// as fast as the CPU allows for tests, bots and balancing.
+
+enum Input
+{
+    INPUT_NONE,
+    INPUT_LEFT,
+    INPUT_RIGHT,
+    INPUT_QUIT
+};
+
+// Enemies live in a structure-of-arrays pool. All columns share one
+// allocation laid out as x | y | fy | vy | free list | alive bitmask, so
+// update loops stream through contiguous ints and copying a pool is one
+// block copy. Released slots go on the free list and are reused by the
+// next spawn.
+//
+// fy and vy are fixed point with FP_SHIFT fraction bits, so each enemy
+// falls at its own sub-row speed; y is fy snapped to the cell row, and is
+// all that collision, the broadphase and drawing look at.
+struct EnemyPool
+{
+    int capacity;
+    int live;
+    int freeTop;
+    int aliveWords;
+    vector<int32_t> block;
+
+    int32_t *x() { return &block[0]; }
+    int32_t *y() { return &block[capacity]; }
+    int32_t *fy() { return &block[2 * capacity]; }
+    int32_t *vy() { return &block[3 * capacity]; }
+    int32_t *freeList() { return &block[4 * capacity]; }
+    uint32_t *alive() { return (uint32_t *)&block[5 * capacity]; }
+    const int32_t *x() const { return &block[0]; }
+    const int32_t *y() const { return &block[capacity]; }
+    const int32_t *fy() const { return &block[2 * capacity]; }
+    const int32_t *vy() const { return &block[3 * capacity]; }
+    const uint32_t *alive() const { return (const uint32_t *)&block[5 * capacity]; }
+};
+
+int poolBlockSize(int capacity)
+{
+    return 5 * capacity + (capacity + 31) / 32;
+}
+
+void poolInit(EnemyPool &p, int capacity)
+{
+    p.capacity = capacity;
+    p.live = 0;
+    p.aliveWords = (capacity + 31) / 32;
+    p.block.assign(poolBlockSize(capacity), 0);
+
+    // Lowest slots come off the free list first.
+    int32_t *freeList = p.freeList();
+    for (int i = 0; i < capacity; i++)
+        freeList[i] = capacity - 1 - i;
+    p.freeTop = capacity;
+}
+
+// fy and vy are fixed point.
+int poolSpawn(EnemyPool &p, int x, int fy, int vy)
+{
+    if (p.freeTop == 0)
+        return -1;
+    int i = p.freeList()[--p.freeTop];
+    p.x()[i] = x;
+    p.y()[i] = fy >> FP_SHIFT;
+    p.fy()[i] = fy;
+    p.vy()[i] = vy;
+    p.alive()[i >> 5] |= 1u << (i & 31);
+    p.live++;
+    return i;
+}
+
+void poolRelease(EnemyPool &p, int i)
+{
+    p.alive()[i >> 5] &= ~(1u << (i & 31));
+    p.vy()[i] = 0;
+    p.freeList()[p.freeTop++] = i;
+    p.live--;
+}
+
+bool poolAlive(const EnemyPool &p, int i)
+{
+    return (p.alive()[i >> 5] >> (i & 31)) & 1;
+}
+
+// Calls fn(index) for every live enemy in slot order.
+template <typename Fn>
+void poolForEach(const EnemyPool &p, Fn fn)
+{
+    const uint32_t *alive = p.alive();
+    for (int w = 0; w < p.aliveWords; w++)
+    {
+        uint32_t bits = alive[w];
+        while (bits)
+        {
+            fn(w * 32 + lowBit(bits));
+            bits &= bits - 1;
+        }
+    }
+}
+
+// Broadphase: live enemies bucketed by lane band (LANE_BAND columns) and
+// row range (BUCKET_ROWS rows) of their top-left corner, stored as a
+// counting-sorted index list. It is rebuilt once per tick in the same pass
+// that moves the enemies, so a collider only visits the few buckets its
+// reach overlaps, however dense the traffic is. Below BROADPHASE_MIN live
+// enemies a straight scan is cheaper than bucketing, so nothing is built.
+// The grid is sized for the road once, by broadphaseInit().
+struct Broadphase
+{
+    bool built;
+    int left;
+    int bands;
+    int rows;
+    vector<int> start;
+    vector<int> fill;
+    vector<int32_t> items;
+};
+
+void broadphaseInit(Broadphase &b, const Road &road)
+{
+    b.built = false;
+    b.left = road.left;
+    b.bands = (road.columns + LANE_BAND - 1) / LANE_BAND;
+    b.rows = (road.carRow + HITBOX_H + BUCKET_ROWS - 1) / BUCKET_ROWS;
+    b.start.assign(b.bands * b.rows + 1, 0);
+    b.fill.assign(b.bands * b.rows, 0);
+}
+
+int bucketOf(const Broadphase &b, int x, int y)
+{
+    int band = min(max((x - b.left) / LANE_BAND, 0), b.bands - 1);
+    int row = min(max(y / BUCKET_ROWS, 0), b.rows - 1);
+    return row * b.bands + band;
+}
+
+void broadphaseBuild(Broadphase &b, const EnemyPool &p)
+{
+    const int32_t *ex = p.x();
+    const int32_t *ey = p.y();
+    int *start = b.start.data();
+    int buckets = b.bands * b.rows;
+
+    b.built = p.live >= BROADPHASE_MIN;
+    if (!b.built)
+        return;
+
+    memset(start, 0, (buckets + 1) * sizeof(int));
+    poolForEach(p, [&](int i) {
+        start[bucketOf(b, ex[i], ey[i]) + 1]++;
+    });
+    for (int k = 0; k < buckets; k++)
+        start[k + 1] += start[k];
+
+    b.items.resize(p.live);
+    int *fill = b.fill.data();
+    memcpy(fill, start, buckets * sizeof(int));
+    poolForEach(p, [&](int i) {
+        b.items[fill[bucketOf(b, ex[i], ey[i])]++] = i;
+    });
+}
+
+// Calls fn(index) for every enemy whose top-left corner may lie inside
+// [x0, x1] x [y0, y1]; callers still run the exact test.
+template <typename Fn>
+void broadphaseQuery(const Broadphase &b, int x0, int y0, int x1, int y1, Fn fn)
+{
+    int b0 = bucketOf(b, x0, y0);
+    int b1 = bucketOf(b, x1, y1);
+    int band0 = b0 % b.bands, band1 = b1 % b.bands;
+    for (int row = b0 / b.bands; row <= b1 / b.bands; row++)
+    {
+        int first = b.start[row * b.bands + band0];
+        int last = b.start[row * b.bands + band1 + 1];
+        for (int k = first; k < last; k++)
+            fn(b.items[k]);
+    }
+}
+
+// COLLISION KERNELS:
+// Hit boxes are HITBOX_W x HITBOX_H rectangles anchored at the sprite's
+// top-left corner: the four drawn cells plus the one-cell margin the game
+// has always used. The batch kernels test one rectangle against every slot
+// of the pool's coordinate columns and mask the result with the alive bits;
+// the widest one the CPU supports is picked once at startup.
+
+struct Rect
+{
+    int x, y, w, h;
+};
+
+bool rectsOverlap(const Rect &a, const Rect &b)
+{
+    return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
+bool enemyOverlaps(int ex, int ey, const Rect &r)
+{
+    return ex < r.x + r.w && ex + HITBOX_W > r.x && ey < r.y + r.h && ey + HITBOX_H > r.y;
+}
+
+// Returns the first live slot whose box overlaps r, or -1.
+typedef int (*CollideKernel)(const int32_t *x, const int32_t *y, const uint32_t *alive, int count, Rect r);
+
+int collideScalar(const int32_t *x, const int32_t *y, const uint32_t *alive, int count, Rect r)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (((alive[i >> 5] >> (i & 31)) & 1) && enemyOverlaps(x[i], y[i], r))
+            return i;
+    }
+    return -1;
+}
+
+#ifdef COLLIDE_SIMD
+
+int collideSse2(const int32_t *x, const int32_t *y, const uint32_t *alive, int count, Rect r)
+{
+    const __m128i xHi = _mm_set1_epi32(r.x + r.w);
+    const __m128i xLo = _mm_set1_epi32(r.x - HITBOX_W);
+    const __m128i yHi = _mm_set1_epi32(r.y + r.h);
+    const __m128i yLo = _mm_set1_epi32(r.y - HITBOX_H);
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i ex = _mm_loadu_si128((const __m128i *)(x + i));
+        __m128i ey = _mm_loadu_si128((const __m128i *)(y + i));
+        __m128i in = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(xHi, ex), _mm_cmpgt_epi32(ex, xLo)),
+                                   _mm_and_si128(_mm_cmpgt_epi32(yHi, ey), _mm_cmpgt_epi32(ey, yLo)));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(in)) & (int)((alive[i >> 5] >> (i & 31)) & 0xF);
+        if (mask)
+            return i + lowBit((uint32_t)mask);
+    }
+    for (; i < count; i++)
+    {
+        if (((alive[i >> 5] >> (i & 31)) & 1) && enemyOverlaps(x[i], y[i], r))
+            return i;
+    }
+    return -1;
+}
+
+TARGET_AVX2 int collideAvx2(const int32_t *x, const int32_t *y, const uint32_t *alive, int count, Rect r)
+{
+    const __m256i xHi = _mm256_set1_epi32(r.x + r.w);
+    const __m256i xLo = _mm256_set1_epi32(r.x - HITBOX_W);
+    const __m256i yHi = _mm256_set1_epi32(r.y + r.h);
+    const __m256i yLo = _mm256_set1_epi32(r.y - HITBOX_H);
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i ex = _mm256_loadu_si256((const __m256i *)(x + i));
+        __m256i ey = _mm256_loadu_si256((const __m256i *)(y + i));
+        __m256i in = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(xHi, ex), _mm256_cmpgt_epi32(ex, xLo)),
+                                      _mm256_and_si256(_mm256_cmpgt_epi32(yHi, ey), _mm256_cmpgt_epi32(ey, yLo)));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(in)) & (int)((alive[i >> 5] >> (i & 31)) & 0xFF);
+        if (mask)
+            return i + lowBit((uint32_t)mask);
+    }
+    for (; i < count; i++)
+    {
+        if (((alive[i >> 5] >> (i & 31)) & 1) && enemyOverlaps(x[i], y[i], r))
+            return i;
+    }
+    return -1;
+}
+
+bool cpuHasAvx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+CollideKernel pickCollideKernel()
+{
+#ifdef COLLIDE_SIMD
+    if (cpuHasAvx2())
+        return collideAvx2;
+    return collideSse2;
+#else
+    return collideScalar;
+#endif
+}
+
+CollideKernel collideKernel = pickCollideKernel();
+
+struct GameState
+{
+    Road road;
+    int carPos;
+    int score;
+    EnemyPool enemies;
+    Broadphase broad;
+    int spawnWave;
+    int sinceSpawn;
+    long long tick;
+    bool over;
+    uint64_t seed;
+    Rng rng;
+};
+
+// The rules are stated once as small helpers on plain values, so the
+// GameState code below and the batched VecEnv apply exactly the same ones.
+
+int spawnColumn(Rng &rng, const Road &road)
+{
+    return road.left + (int)rngBounded(rng, road.columns);
+}
+
+// A new wave enters at the top SPAWN_GAP ticks after the previous one, as
+// long as the pool has room. With the default traffic of
+// two this is the classic one car at a time with a second one trailing.
+// Returns how many cars enter now.
+int waveSize(int sinceSpawn, int live, int capacity, int wave)
+{
+    if (sinceSpawn < SPAWN_GAP || live == capacity)
+        return 0;
+    return min(wave, capacity - live);
+}
+
+// Speed of a car entering now, in rows per tick with FP_SHIFT fraction
+// bits. It starts at the classic one row per tick and gains SPEED_RAMP
+// for every point scored, up to ENEMY_MAX_SPEED; a car keeps the speed it
+// entered with. The cap stays below HITBOX_H rows, so a car can never
+// jump over the player's box in one tick.
+int enemySpeed(int score)
+{
+    return min(ENEMY_SPEED + score * SPEED_RAMP, ENEMY_MAX_SPEED);
+}
+
+// An enemy that has dropped below the car row leaves and scores a point.
+bool enemyPassed(int ey, int carRow)
+{
+    return ey > carRow;
+}
+
+int steerPos(int pos, Input in, int carMin, int carMax)
+{
+    if (in == INPUT_LEFT && pos > carMin)
+        return pos - CAR_STEP;
+    if (in == INPUT_RIGHT && pos < carMax)
+        return pos + CAR_STEP;
+    return pos;
+}
+
+Rect carRectAt(int pos, int carRow)
+{
+    Rect r = {pos, carRow, HITBOX_W, HITBOX_H};
+    return r;
+}
+
+// The middle lane.
+int roadStart(const Road &road)
+{
+    return laneX(road, road.lanes / 2);
+}
+
+void spawnEnemies(GameState &s)
+{
+    int n = waveSize(s.sinceSpawn, s.enemies.live, s.enemies.capacity, s.spawnWave);
+    if (n == 0)
+        return;
+
+    for (int i = 0; i < n; i++)
+        poolSpawn(s.enemies, spawnColumn(s.rng, s.road), SPAWN_ROW << FP_SHIFT, enemySpeed(s.score));
+    s.sinceSpawn = 0;
+}
+
+void resetGame(GameState &s, uint64_t seed, int traffic = DEFAULT_TRAFFIC, const Road &road = classicRoad)
+{
+    s.seed = seed;
+    rngSeed(s.rng, seed);
+    s.road = road;
+    s.carPos = roadStart(road);
+    s.score = 0;
+    s.tick = 0;
+    s.over = false;
+    poolInit(s.enemies, traffic);
+    s.spawnWave = (traffic + 1) / 2;
+    s.sinceSpawn = SPAWN_GAP;
+    spawnEnemies(s);
+    broadphaseInit(s.broad, road);
+    broadphaseBuild(s.broad, s.enemies);
+}
+
+Rect carRect(const GameState &s)
+{
+    return carRectAt(s.carPos, s.road.carRow);
+}
+
+int collision(const GameState &s)
+{
+    const EnemyPool &p = s.enemies;
+    Rect car = carRect(s);
+
+    if (!s.broad.built)
+        return collideKernel(p.x(), p.y(), p.alive(), p.capacity, car) >= 0;
+
+    const int32_t *ex = p.x();
+    const int32_t *ey = p.y();
+    int hit = 0;
+    broadphaseQuery(s.broad, car.x - HITBOX_W + 1, car.y - HITBOX_H + 1, car.x + car.w - 1, car.y + car.h - 1, [&](int i) {
+        if (enemyOverlaps(ex[i], ey[i], car))
+            hit = 1;
+    });
+    return hit;
+}
+
+// Moves the car for one steering input and tests for a crash at once, so
+// a move can be applied (and shown) between ticks.
+void steer(GameState &s, Input in)
+{
+    if (s.over)
+        return;
+
+    s.carPos = steerPos(s.carPos, in, roadCarMin(s.road), roadCarMax(s.road));
+
+    PhaseScope timing(PHASE_COLLISION);
+    if (collision(s) == 1)
+        s.over = true;
+}
+
+// Moves the world on by one tick: enemies fall, those past the car score
+// and leave, and the next wave may enter. Nothing here looks at the car.
+void advance(GameState &s)
+{
+    s.tick++;
+
+    EnemyPool &p = s.enemies;
+    int32_t *ey = p.y();
+    int32_t *fy = p.fy();
+    const int32_t *vy = p.vy();
+    for (int i = 0; i < p.capacity; i++)
+    {
+        fy[i] += vy[i];
+        ey[i] = fy[i] >> FP_SHIFT;
+    }
+    s.sinceSpawn++;
+
+    poolForEach(p, [&](int i) {
+        if (enemyPassed(ey[i], s.road.carRow))
+        {
+            poolRelease(p, i);
+            s.score++;
+        }
+    });
+
+    spawnEnemies(s);
+    broadphaseBuild(s.broad, p);
+}
+
+// Advances the game by one tick. The state as it stands after the move is
+// what the player sees, so collision is tested before the enemies advance.
+void step(GameState &s, Input in)
+{
+    steer(s, in);
+    if (s.over)
+        return;
+
+    PhaseScope timing(PHASE_UPDATE);
+    advance(s);
+}
+
+// POLICIES:
+// A policy picks the input for the next tick from the game state alone,
+// plus a generator of its own so that a game seed still fixes the whole
+// run. They drive headless games for batch runs and soak tests.
+
+typedef Input (*Policy)(const GameState &s, Rng &rng);
+
+Input policyStay(const GameState &, Rng &)
+{
+    return INPUT_NONE;
+}
+
+Input policyRandom(const GameState &, Rng &rng)
+{
+    return (Input)rngBounded(rng, 3);
+}
+
+// True if an enemy will reach a car at column pos within the next
+// `ticks` ticks.
+bool laneThreatened(const GameState &s, int pos, int ticks)
+{
+    const EnemyPool &p = s.enemies;
+    const int32_t *ex = p.x();
+    const int32_t *ey = p.y();
+    const int32_t *fy = p.fy();
+    const int32_t *vy = p.vy();
+    bool threat = false;
+    poolForEach(p, [&](int i) {
+        int reach = (fy[i] + vy[i] * ticks) >> FP_SHIFT;
+        if (abs(ex[i] - pos) < HITBOX_W && reach > s.road.carRow - HITBOX_H && ey[i] < s.road.carRow + HITBOX_H)
+            threat = true;
+    });
+    return threat;
+}
+
+// Greedy dodger: stays put unless something is about to land on the car,
+// then takes whichever neighbouring lane is clear.
+Input policyDodge(const GameState &s, Rng &)
+{
+    if (!laneThreatened(s, s.carPos, 2))
+        return INPUT_NONE;
+    if (s.carPos > roadCarMin(s.road) && !laneThreatened(s, s.carPos - CAR_STEP, 2))
+        return INPUT_LEFT;
+    if (s.carPos < roadCarMax(s.road) && !laneThreatened(s, s.carPos + CAR_STEP, 2))
+        return INPUT_RIGHT;
+    return INPUT_NONE;
+}
+
+// Autopilot: the enemies' future does not depend on the car, so one
+// rollout of the world AUTOPILOT_HORIZON ticks ahead tells which lanes are
+// safe at every tick. The search then walks (tick, lane) states depth
+// first, trying "stay" before either move, remembers how long each state
+// survives so it is expanded once, and stops as soon as a path lasts the
+// whole horizon. A decision is a few dozen ticks of simulation and at most
+// a few hundred lane checks, microseconds against the 50 ms frame.
+struct Autopilot
+{
+    GameState world;
+    int lanes;
+    bool safe[AUTOPILOT_HORIZON + 1][MAX_LANES];
+    signed char survive[AUTOPILOT_HORIZON + 1][MAX_LANES];
+};
+
+thread_local Autopilot autopilot;
+
+void autopilotForecast(Autopilot &ap, const GameState &s)
+{
+    ap.world = s;
+    ap.lanes = s.road.lanes;
+    for (int k = 0; k <= AUTOPILOT_HORIZON; k++)
+    {
+        for (int lane = 0; lane < ap.lanes; lane++)
+        {
+            ap.world.carPos = laneX(s.road, lane);
+            ap.safe[k][lane] = collision(ap.world) == 0;
+        }
+        if (k < AUTOPILOT_HORIZON)
+            advance(ap.world);
+    }
+}
+
+// Number of collision checks a car in `lane` at tick k passes before it
+// is hit, counting the one at tick k; AUTOPILOT_HORIZON - k + 1 means it
+// gets through the whole window.
+int autopilotSurvive(Autopilot &ap, int k, int lane)
+{
+    if (!ap.safe[k][lane])
+        return 0;
+    if (k == AUTOPILOT_HORIZON)
+        return 1;
+    if (ap.survive[k][lane] >= 0)
+        return ap.survive[k][lane];
+
+    const int moves[3] = {0, -1, 1};
+    int best = 0;
+    for (int d : moves)
+    {
+        int next = lane + d;
+        if (next < 0 || next >= ap.lanes)
+            continue;
+        best = max(best, autopilotSurvive(ap, k + 1, next));
+        if (best == AUTOPILOT_HORIZON - k)
+            break;
+    }
+    ap.survive[k][lane] = (signed char)(best + 1);
+    return best + 1;
+}
+
+Input policyAutopilot(const GameState &s, Rng &)
+{
+    Autopilot &ap = autopilot;
+    autopilotForecast(ap, s);
+    memset(ap.survive, -1, sizeof(ap.survive));
+
+    const Input inputs[3] = {INPUT_NONE, INPUT_LEFT, INPUT_RIGHT};
+    const int moves[3] = {0, -1, 1};
+    int lane = (s.carPos - roadCarMin(s.road)) / CAR_STEP;
+    Input choice = INPUT_NONE;
+    int best = -1;
+    for (int m = 0; m < 3; m++)
+    {
+        int next = lane + moves[m];
+        if (next < 0 || next >= ap.lanes)
+            continue;
+        int ticks = autopilotSurvive(ap, 0, next);
+        if (ticks > best)
+        {
+            best = ticks;
+            choice = inputs[m];
+        }
+        if (best == AUTOPILOT_HORIZON + 1)
+            break;
+    }
+    return choice;
+}
+
+struct PolicyEntry
+{
+    const char *name;
+    Policy fn;
+};
+
+const PolicyEntry policies[] = {
+    {"stay", policyStay},
+    {"random", policyRandom},
+    {"dodge", policyDodge},
+    {"autopilot", policyAutopilot},
+};
+
+Policy findPolicy(const string &name)
+{
+    for (const PolicyEntry &e : policies)
+        if (name == e.name)
+            return e.fn;
+    return NULL;
+}
+
+// VECTOR ENV:
+// Many games advanced together for training and tuning. Every per-game
+// field is a column indexed by game, and enemy slot k of all games is one
+// contiguous run of the enemy columns (index k * stride + game), so each
+// phase of a step is a branch-free loop over games. Columns are padded to
+// a multiple of VEC_BLOCK and the loops walk them in fixed blocks with
+// restrict pointers, which is what lets compilers vectorise them at -O2.
+// Padding games never have enemies and are never reported. Only spawning
+// and resets, which touch the generators, run one game at a time.
+//
+// vecEnvStep(v, actions) plays one tick of every game with the same
+// helpers as step(). A game that crashes reports done and finalScore for
+// that step and is reset at once to the next seed in sequence; game g
+// started by an env always uses seed mixSeed(seed + g), so a run is
+// reproducible and each game matches resetGame() with that seed.
+
+#define VEC_BLOCK 8
+
+struct VecEnv
+{
+    int count;
+    int stride;
+    int capacity;
+    int wave;
+    Road road;
+    uint64_t baseSeed;
+    uint64_t gamesStarted;
+
+    vector<int32_t> carPos;
+    vector<int32_t> action;
+    vector<int32_t> score;
+    vector<int32_t> tick;
+    vector<int32_t> sinceSpawn;
+    vector<int32_t> enemyCount;
+    vector<int32_t> done;
+    vector<int32_t> finalScore;
+    vector<uint64_t> seed;
+    vector<Rng> rng;
+
+    vector<int32_t> ex;
+    vector<int32_t> ey;
+    vector<int32_t> fy;
+    vector<int32_t> vy;
+    vector<int32_t> alive;
+};
+
+void vecEnvSpawn(VecEnv &v, int g)
+{
+    int n = waveSize(v.sinceSpawn[g], v.enemyCount[g], v.capacity, v.wave);
+    if (n == 0)
+        return;
+
+    // Lowest free slots first, as in EnemyPool.
+    for (int k = 0, left = n; k < v.capacity && left > 0; k++)
+    {
+        size_t j = (size_t)k * v.stride + g;
+        if (v.alive[j])
+            continue;
+        v.ex[j] = spawnColumn(v.rng[g], v.road);
+        v.ey[j] = SPAWN_ROW;
+        v.fy[j] = SPAWN_ROW << FP_SHIFT;
+        v.vy[j] = enemySpeed(v.score[g]);
+        v.alive[j] = 1;
+        left--;
+    }
+    v.enemyCount[g] += n;
+    v.sinceSpawn[g] = 0;
+}
+
+void vecEnvReset(VecEnv &v, int g)
+{
+    uint64_t seed = mixSeed(v.baseSeed + v.gamesStarted++);
+    v.seed[g] = seed;
+    rngSeed(v.rng[g], seed);
+    v.carPos[g] = roadStart(v.road);
+    v.score[g] = 0;
+    v.tick[g] = 0;
+    v.enemyCount[g] = 0;
+    for (int k = 0; k < v.capacity; k++)
+    {
+        size_t j = (size_t)k * v.stride + g;
+        v.alive[j] = 0;
+        v.vy[j] = 0;
+    }
+    v.sinceSpawn[g] = SPAWN_GAP;
+    vecEnvSpawn(v, g);
+}
+
+void vecEnvInit(VecEnv &v, int count, uint64_t seed, int traffic = DEFAULT_TRAFFIC, const Road &road = classicRoad)
+{
+    v.count = count;
+    v.stride = (count + VEC_BLOCK - 1) / VEC_BLOCK * VEC_BLOCK;
+    v.capacity = traffic;
+    v.wave = (traffic + 1) / 2;
+    v.road = road;
+    v.baseSeed = seed;
+    v.gamesStarted = 0;
+
+    vector<int32_t> *columns[] = {&v.carPos, &v.action, &v.score, &v.tick, &v.sinceSpawn, &v.enemyCount, &v.done, &v.finalScore};
+    for (vector<int32_t> *c : columns)
+        c->assign(v.stride, 0);
+    v.seed.assign(v.stride, 0);
+    v.rng.assign(v.stride, Rng());
+    v.ex.assign((size_t)v.stride * traffic, 0);
+    v.ey.assign((size_t)v.stride * traffic, 0);
+    v.fy.assign((size_t)v.stride * traffic, 0);
+    v.vy.assign((size_t)v.stride * traffic, 0);
+    v.alive.assign((size_t)v.stride * traffic, 0);
+
+    for (int g = 0; g < count; g++)
+        vecEnvReset(v, g);
+    for (int g = count; g < v.stride; g++)
+        v.carPos[g] = roadStart(road);
+}
+
+void vecSteer(int n, int carMin, int carMax, int32_t *__restrict carPos, const int32_t *__restrict action,
+              int32_t *__restrict done)
+{
+    for (int b = 0; b < n; b += VEC_BLOCK)
+        for (int g = b; g < b + VEC_BLOCK; g++)
+        {
+            carPos[g] = steerPos(carPos[g], (Input)action[g], carMin, carMax);
+            done[g] = 0;
+        }
+}
+
+void vecCollideSlot(int n, int carRow, const int32_t *__restrict ex, const int32_t *__restrict ey,
+                    const int32_t *__restrict alive, const int32_t *__restrict carPos, int32_t *__restrict done)
+{
+    for (int b = 0; b < n; b += VEC_BLOCK)
+        for (int g = b; g < b + VEC_BLOCK; g++)
+            done[g] |= alive[g] & (int32_t)enemyOverlaps(ex[g], ey[g], carRectAt(carPos[g], carRow));
+}
+
+// A crashed game stands still, as step() leaves it.
+void vecAdvanceClock(int n, const int32_t *__restrict done, int32_t *__restrict tick, int32_t *__restrict sinceSpawn)
+{
+    for (int b = 0; b < n; b += VEC_BLOCK)
+        for (int g = b; g < b + VEC_BLOCK; g++)
+        {
+            tick[g] += 1 - done[g];
+            sinceSpawn[g] += 1 - done[g];
+        }
+}
+
+void vecAdvanceSlot(int n, int carRow, const int32_t *__restrict done, int32_t *__restrict ey, int32_t *__restrict fy,
+                    int32_t *__restrict vy, int32_t *__restrict alive, int32_t *__restrict score,
+                    int32_t *__restrict enemyCount)
+{
+    for (int b = 0; b < n; b += VEC_BLOCK)
+        for (int g = b; g < b + VEC_BLOCK; g++)
+        {
+            int32_t running = 1 - done[g];
+            fy[g] += vy[g] * running;
+            ey[g] = fy[g] >> FP_SHIFT;
+            int32_t passed = alive[g] & running & (int32_t)enemyPassed(ey[g], carRow);
+            alive[g] &= ~passed;
+            vy[g] *= 1 - passed;
+            score[g] += passed;
+            enemyCount[g] -= passed;
+        }
+}
+
+void vecEnvStep(VecEnv &v, const Input *actions)
+{
+    const int n = v.stride;
+    for (int g = 0; g < v.count; g++)
+        v.action[g] = actions[g];
+
+    // Move every car and test it against its game's enemies; done holds
+    // the crash flag until the games are reset below.
+    vecSteer(n, roadCarMin(v.road), roadCarMax(v.road), v.carPos.data(), v.action.data(), v.done.data());
+    for (int k = 0; k < v.capacity; k++)
+    {
+        size_t slot = (size_t)k * n;
+        vecCollideSlot(n, v.road.carRow, &v.ex[slot], &v.ey[slot], &v.alive[slot], v.carPos.data(), v.done.data());
+    }
+
+    vecAdvanceClock(n, v.done.data(), v.tick.data(), v.sinceSpawn.data());
+    for (int k = 0; k < v.capacity; k++)
+    {
+        size_t slot = (size_t)k * n;
+        vecAdvanceSlot(n, v.road.carRow, v.done.data(), &v.ey[slot], &v.fy[slot], &v.vy[slot], &v.alive[slot], v.score.data(),
+                       v.enemyCount.data());
+    }
+
+    for (int g = 0; g < v.count; g++)
+    {
+        if (v.done[g])
+        {
+            v.finalScore[g] = v.score[g];
+            vecEnvReset(v, g);
+        }
+        else
+            vecEnvSpawn(v, g);
+    }
+}
+
+// SNAPSHOTS:
+// Everything a game needs to go on, as one flat record: the Snapshot
+// fields followed by a copy of the enemy pool's block. Taking or restoring
+// one is two memcpys into memory the caller owns, with no allocation, so
+// it is cheap enough to do every tick. The broadphase is derived data and
+// is rebuilt on restore.
+
+struct Snapshot
+{
+    int64_t tick;
+    uint64_t seed;
+    uint64_t rngState;
+    uint64_t rngInc;
+    int32_t carPos;
+    int32_t score;
+    int32_t spawnWave;
+    int32_t sinceSpawn;
+    int32_t live;
+    int32_t freeTop;
+};
+
+size_t snapshotSize(int capacity)
+{
+    return sizeof(Snapshot) + poolBlockSize(capacity) * sizeof(int32_t);
+}
+
+void snapshotSave(const GameState &s, uint8_t *out)
+{
+    Snapshot head = {s.tick, s.seed, s.rng.state, s.rng.inc, s.carPos, s.score, s.spawnWave, s.sinceSpawn, s.enemies.live, s.enemies.freeTop};
+    memcpy(out, &head, sizeof(head));
+    memcpy(out + sizeof(head), s.enemies.block.data(), s.enemies.block.size() * sizeof(int32_t));
+}
+
+// s must already hold a game with the same traffic and road, e.g. from
+// resetGame().
+void snapshotLoad(GameState &s, const uint8_t *in)
+{
+    Snapshot head;
+    memcpy(&head, in, sizeof(head));
+    memcpy(s.enemies.block.data(), in + sizeof(head), s.enemies.block.size() * sizeof(int32_t));
+    s.tick = head.tick;
+    s.seed = head.seed;
+    s.rng.state = head.rngState;
+    s.rng.inc = head.rngInc;
+    s.carPos = head.carPos;
+    s.score = head.score;
+    s.spawnWave = head.spawnWave;
+    s.sinceSpawn = head.sinceSpawn;
+    s.enemies.live = head.live;
+    s.enemies.freeTop = head.freeTop;
+    s.over = false;
+    broadphaseBuild(s.broad, s.enemies);
+}
+
+// snapshotLoad() trusts its input; snapshots read from a file go through
+// here first. A pool is usable when the alive bits count exactly `live`
+// slots below capacity and the free list holds every other slot once, so
+// poolSpawn() and poolRelease() stay inside the block.
+bool snapshotValid(const uint8_t *in, int capacity)
+{
+    Snapshot head;
+    memcpy(&head, in, sizeof(head));
+    if (head.tick < 0 || head.live < 0 || head.live > capacity || head.freeTop != capacity - head.live)
+        return false;
+
+    const int32_t *block = (const int32_t *)(in + sizeof(head));
+    const int32_t *freeList = block + 4 * capacity;
+    const uint32_t *alive = (const uint32_t *)(block + 5 * capacity);
+    int words = (capacity + 31) / 32;
+    if (capacity % 32 != 0 && (alive[words - 1] >> (capacity % 32)) != 0)
+        return false;
+    int live = 0;
+    for (int w = 0; w < words; w++)
+        for (uint32_t bits = alive[w]; bits; bits &= bits - 1)
+            live++;
+    if (live != head.live)
+        return false;
+
+    vector<uint32_t> taken(alive, alive + words);
+    for (int k = 0; k < head.freeTop; k++)
+    {
+        int32_t i = freeList[k];
+        if (i < 0 || i >= capacity || ((taken[i >> 5] >> (i & 31)) & 1))
+            return false;
+        taken[i >> 5] |= 1u << (i & 31);
+    }
+    return true;
+}
+
+// A ring of the most recent snapshots, one per tick, allocated once.
+// Rewinding drops everything newer than the restored tick, so play simply
+// carries on from there.
+struct SnapshotRing
+{
+    int slots;
+    int count;
+    int head;
+    size_t slotSize;
+    vector<uint8_t> data;
+};
+
+void ringInit(SnapshotRing &r, int slots, int capacity)
+{
+    r.slots = slots;
+    r.count = 0;
+    r.head = 0;
+    r.slotSize = snapshotSize(capacity);
+    r.data.assign(r.slotSize * slots, 0);
+}
+
+// Returns the slot the snapshot went to.
+int ringPush(SnapshotRing &r, const GameState &s)
+{
+    int slot = r.head;
+    snapshotSave(s, &r.data[r.slotSize * slot]);
+    r.head = (r.head + 1) % r.slots;
+    r.count = min(r.count + 1, r.slots);
+    return slot;
+}
+
+// Restores the snapshot taken `ticks` ticks before the newest one, or the
+// oldest kept. Returns its slot, or -1 if the ring is empty.
+int ringRewind(SnapshotRing &r, int ticks, GameState &s)
+{
+    if (r.count == 0)
+        return -1;
+    int back = min(ticks, r.count - 1);
+    int slot = (r.head - 1 - back + r.slots) % r.slots;
+    snapshotLoad(s, &r.data[r.slotSize * slot]);
+    r.count -= back;
+    r.head = (slot + 1) % r.slots;
+    return slot;
+}
+
+// REPLAYS:
+// A game is fully determined by its seed and the inputs applied at each
+// tick, so that is all a replay stores. The file is
+//
+//   header | events | index | keyframe states
+//
+// Events are one LEB128 varint each, (ticks since the previous event << 2)
+// | input, which is a byte or two per key press. Every
+// REPLAY_KEYFRAME_TICKS the recorder also keeps a snapshot taken at the
+// start of that tick. The index lists the keyframes by tick with the event offset to
+// resume from, so seeking is a binary search plus at most one keyframe
+// interval of re-simulation. Fields are little-endian, as written by the
+// x86 and ARM targets we build for.
+
+#define REPLAY_VERSION 4
+
+struct ReplayHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t seed;
+    uint32_t traffic;
+    uint32_t finalScore;
+    uint64_t finalTick;
+    uint32_t over;
+    uint32_t keyframes;
+    uint32_t lanes;
+    uint32_t carRow;
+    uint64_t eventBytes;
+    uint64_t eventCount;
+};
+
+struct ReplayKeyframe
+{
+    uint64_t tick;
+    uint64_t eventOffset;
+    uint64_t lastEventTick;
+};
+
+size_t replayIndexOffset(const ReplayHeader &h)
+{
+    return (sizeof(ReplayHeader) + h.eventBytes + 7) & ~(size_t)7;
+}
+
+void putVarint(vector<uint8_t> &out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+// Returns false on a truncated or overlong varint.
+bool getVarint(const uint8_t *data, size_t size, size_t &pos, uint64_t &v)
+{
+    v = 0;
+    for (int shift = 0; shift < 64 && pos < size; shift += 7)
+    {
+        uint8_t b = data[pos++];
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+struct ReplayRecorder
+{
+    bool enabled;
+    uint64_t seed;
+    int traffic;
+    vector<uint8_t> events;
+    uint64_t eventCount;
+    long long lastEventTick;
+    vector<ReplayKeyframe> index;
+    vector<uint8_t> states;
+};
+
+void recordKeyframe(ReplayRecorder &rec, const GameState &s)
+{
+    ReplayKeyframe k = {(uint64_t)s.tick, rec.events.size(), (uint64_t)rec.lastEventTick};
+    rec.index.push_back(k);
+    size_t at = rec.states.size();
+    rec.states.resize(at + snapshotSize(s.enemies.capacity));
+    snapshotSave(s, &rec.states[at]);
+}
+
+void recorderStart(ReplayRecorder &rec, const GameState &s)
+{
+    rec.seed = s.seed;
+    rec.traffic = s.enemies.capacity;
+    rec.events.clear();
+    rec.eventCount = 0;
+    rec.lastEventTick = 0;
+    rec.index.clear();
+    rec.states.clear();
+    if (rec.enabled)
+        recordKeyframe(rec, s);
+}
+
+// Call just before an input is applied with steer() or step().
+void recordInput(ReplayRecorder &rec, const GameState &s, Input in)
+{
+    if (!rec.enabled || in == INPUT_NONE)
+        return;
+    putVarint(rec.events, ((uint64_t)(s.tick - rec.lastEventTick) << 2) | in);
+    rec.lastEventTick = s.tick;
+    rec.eventCount++;
+}
+
+// Where the recording stood at some tick, so a rewind can cut it back.
+struct ReplayMark
+{
+    size_t eventBytes;
+    uint64_t eventCount;
+    long long lastEventTick;
+    size_t keyframes;
+};
+
+ReplayMark recorderMark(const ReplayRecorder &rec)
+{
+    ReplayMark m = {rec.events.size(), rec.eventCount, rec.lastEventTick, rec.index.size()};
+    return m;
+}
+
+void recorderRewind(ReplayRecorder &rec, const ReplayMark &m)
+{
+    if (!rec.enabled)
+        return;
+    rec.events.resize(m.eventBytes);
+    rec.eventCount = m.eventCount;
+    rec.lastEventTick = m.lastEventTick;
+    rec.index.resize(m.keyframes);
+    rec.states.resize(m.keyframes * snapshotSize(rec.traffic));
+}
+
+// Call after every step().
+void recordTick(ReplayRecorder &rec, const GameState &s)
+{
+    if (rec.enabled && !s.over && s.tick % REPLAY_KEYFRAME_TICKS == 0 && rec.index.back().tick != (uint64_t)s.tick)
+        recordKeyframe(rec, s);
+}
+
+bool replaySave(const ReplayRecorder &rec, const GameState &s, const char *path)
+{
+    ReplayHeader h;
+    memcpy(h.magic, "CGRP", 4);
+    h.version = REPLAY_VERSION;
+    h.seed = rec.seed;
+    h.traffic = rec.traffic;
+    h.finalScore = s.score;
+    h.finalTick = s.tick;
+    h.over = s.over;
+    h.keyframes = (uint32_t)rec.index.size();
+    h.lanes = s.road.lanes;
+    h.carRow = s.road.carRow;
+    h.eventBytes = rec.events.size();
+    h.eventCount = rec.eventCount;
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+        return false;
+    const char zeros[8] = {0};
+    size_t pad = replayIndexOffset(h) - sizeof(h) - rec.events.size();
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+              (rec.events.empty() || fwrite(rec.events.data(), 1, rec.events.size(), f) == rec.events.size()) &&
+              fwrite(zeros, 1, pad, f) == pad &&
+              fwrite(rec.index.data(), sizeof(ReplayKeyframe), rec.index.size(), f) == rec.index.size() &&
+              fwrite(rec.states.data(), 1, rec.states.size(), f) == rec.states.size();
+    return fclose(f) == 0 && ok;
+}
+
+struct ReplayPlayer
+{
+    MappedFile file;
+    ReplayHeader header;
+    const uint8_t *events;
+    const ReplayKeyframe *index;
+    const uint8_t *states;
+    size_t stateSize;
+
+    GameState state;
+    size_t cursor;
+    long long lastEventTick;
+    bool haveEvent;
+    long long eventTick;
+    Input eventInput;
+};
+
+// Checks that every part the header describes lies inside the file and
+// that every keyframe can be loaded.
+bool replayOpen(ReplayPlayer &p, const char *path)
+{
+    if (!mapFile(path, p.file))
+    {
+        fprintf(stderr, "%s: cannot open replay\n", path);
+        return false;
+    }
+    ReplayHeader &h = p.header;
+    bool ok = p.file.size >= sizeof(h);
+    if (ok)
+    {
+        memcpy(&h, p.file.data, sizeof(h));
+        ok = memcmp(h.magic, "CGRP", 4) == 0 && h.version == REPLAY_VERSION && h.traffic >= 1 && h.traffic <= 1000000 &&
+             h.keyframes >= 1 && h.lanes >= 1 && h.lanes <= MAX_LANES && h.carRow >= CLASSIC_HEIGHT - HITBOX_H &&
+             h.carRow <= MAX_ROWS - HITBOX_H && h.eventBytes <= p.file.size;
+    }
+    if (ok)
+    {
+        p.stateSize = snapshotSize(h.traffic);
+        size_t indexOffset = replayIndexOffset(h);
+        size_t statesOffset = indexOffset + (size_t)h.keyframes * sizeof(ReplayKeyframe);
+        ok = statesOffset + (size_t)h.keyframes * p.stateSize <= p.file.size;
+        p.events = p.file.data + sizeof(h);
+        p.index = (const ReplayKeyframe *)(p.file.data + indexOffset);
+        p.states = p.file.data + statesOffset;
+    }
+    // Keyframes are loaded straight into the enemy pool, so a damaged one
+    // must be caught here rather than when a seek lands on it.
+    for (uint32_t k = 0; ok && k < h.keyframes; k++)
+    {
+        const ReplayKeyframe &key = p.index[k];
+        Snapshot head;
+        memcpy(&head, p.states + (size_t)k * p.stateSize, sizeof(head));
+        ok = (k == 0 || key.tick > p.index[k - 1].tick) && key.eventOffset <= h.eventBytes && key.lastEventTick <= key.tick &&
+             head.tick == (int64_t)key.tick && snapshotValid(p.states + (size_t)k * p.stateSize, h.traffic);
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "%s: not a replay file\n", path);
+        unmapFile(p.file);
+        return false;
+    }
+    resetGame(p.state, h.seed, h.traffic, roadWith(h.lanes, h.carRow));
+    return true;
+}
+
+void replayClose(ReplayPlayer &p)
+{
+    unmapFile(p.file);
+}
+
+void replayNextEvent(ReplayPlayer &p)
+{
+    uint64_t v;
+    p.haveEvent = getVarint(p.events, p.header.eventBytes, p.cursor, v);
+    if (!p.haveEvent)
+        return;
+    p.eventTick = p.lastEventTick + (long long)(v >> 2);
+    p.eventInput = (Input)(v & 3);
+    p.lastEventTick = p.eventTick;
+}
+
+bool replayFinished(const ReplayPlayer &p)
+{
+    return p.state.over || p.state.tick >= (long long)p.header.finalTick;
+}
+
+// Plays the recorded inputs of the current tick and advances to the next.
+// The tick the game ended on is played but not advanced past.
+void replayStep(ReplayPlayer &p)
+{
+    if (p.state.over)
+        return;
+    while (p.haveEvent && p.eventTick == p.state.tick)
+    {
+        steer(p.state, p.eventInput);
+        replayNextEvent(p);
+    }
+    if (p.state.tick < (long long)p.header.finalTick || p.header.over)
+        step(p.state, INPUT_NONE);
+}
+
+// Leaves the state at the start of `tick`, before its inputs.
+void replaySeek(ReplayPlayer &p, long long tick)
+{
+    tick = max(0LL, min(tick, (long long)p.header.finalTick));
+
+    // Last keyframe at or before tick.
+    int lo = 0, hi = (int)p.header.keyframes;
+    while (hi - lo > 1)
+    {
+        int mid = (lo + hi) / 2;
+        if ((long long)p.index[mid].tick <= tick)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    const ReplayKeyframe &k = p.index[lo];
+    snapshotLoad(p.state, p.states + (size_t)lo * p.stateSize);
+    p.cursor = k.eventOffset;
+    p.lastEventTick = (long long)k.lastEventTick;
+    replayNextEvent(p);
+
+    while (p.state.tick < tick && !p.state.over)
+        replayStep(p);
+}
+
+// HIGH SCORES:
+// Finished games go to an append-only log, PATH.log, as fixed-size records
+// that each end in a CRC32. A writer that dies mid-append can leave part of
+// a record at the end of the log, or whole records that never reached the
+// disk and fail their check. Loading skips records that fail, and every
+// append first cuts the log back to a whole number of records, so the
+// records after a torn one stay readable. Once the log holds
+// SCORE_COMPACT_RECORDS records it is merged
+// with the sorted snapshot, PATH.snap, into a new snapshot of the best
+// SCORES_KEPT, which atomically replaces the old one before the log is
+// emptied. A crash between those two steps leaves the same records in
+// both files, and loading drops exact duplicates.
+//
+// Writes are group-committed. The first submitter to find no flush in
+// progress writes every queued record with one write and one fsync while
+// later submitters wait for it, so sessions that finish together share a
+// disk sync. Appends and compaction hold an exclusive lock on the log, so
+// several game processes can use the same files without their writes
+// interleaving. After a failed write the store stops writing rather than
+// guess what reached the disk.
+
+struct ScoreRecord
+{
+    int64_t time;
+    uint64_t seed;
+    int64_t ticks;
+    int32_t score;
+    int32_t traffic;
+    uint32_t reserved;
+    uint32_t crc;
+};
+
+struct ScoreSnapHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t crc;
+};
+
+struct Crc32Table
+{
+    uint32_t entry[256];
+};
+
+constexpr Crc32Table makeCrc32Table()
+{
+    Crc32Table t = {};
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        t.entry[i] = c;
+    }
+    return t;
+}
+
+constexpr Crc32Table crc32Table = makeCrc32Table();
+
+uint32_t crc32(const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t c = 0xffffffffu;
+    for (size_t i = 0; i < len; i++)
+        c = crc32Table.entry[(c ^ p[i]) & 0xff] ^ (c >> 8);
+    return c ^ 0xffffffffu;
+}
+
+bool scoreRecordValid(const ScoreRecord &r)
+{
+    return r.crc == crc32(&r, offsetof(ScoreRecord, crc));
+}
+
+// Best first; earlier games win ties.
+bool scoreBetter(const ScoreRecord &a, const ScoreRecord &b)
+{
+    if (a.score != b.score)
+        return a.score > b.score;
+    if (a.time != b.time)
+        return a.time < b.time;
+    return a.seed < b.seed;
+}
+
+// Adds r to a best-first list of at most SCORES_KEPT entries. Returns its
+// rank from 0, or -1 if it did not make the list or was already there.
+int scoreInsert(vector<ScoreRecord> &top, const ScoreRecord &r)
+{
+    vector<ScoreRecord>::iterator at = lower_bound(top.begin(), top.end(), r, scoreBetter);
+    if (at != top.end() && memcmp(&*at, &r, sizeof(r)) == 0)
+        return -1;
+    int rank = (int)(at - top.begin());
+    if (rank >= SCORES_KEPT)
+        return -1;
+    top.insert(at, r);
+    if ((int)top.size() > SCORES_KEPT)
+        top.pop_back();
+    return rank;
+}
+
+void scoreLoadSnapshot(const string &path, vector<ScoreRecord> &top)
+{
+    MappedFile m;
+    if (!mapFile(path.c_str(), m))
+        return;
+    ScoreSnapHeader h;
+    if (m.size >= sizeof(h))
+    {
+        memcpy(&h, m.data, sizeof(h));
+        size_t bytes = (size_t)h.count * sizeof(ScoreRecord);
+        if (memcmp(h.magic, "CGHS", 4) == 0 && h.version == 1 && sizeof(h) + bytes <= m.size &&
+            crc32(m.data + sizeof(h), bytes) == h.crc)
+        {
+            for (uint32_t i = 0; i < h.count; i++)
+            {
+                ScoreRecord r;
+                memcpy(&r, m.data + sizeof(h) + i * sizeof(r), sizeof(r));
+                scoreInsert(top, r);
+            }
+        }
+    }
+    unmapFile(m);
+}
+
+// Adds every intact record of the log to top and counts them.
+void scoreLoadLog(const string &path, vector<ScoreRecord> &top, long long &records)
+{
+    MappedFile m;
+    records = 0;
+    if (!mapFile(path.c_str(), m))
+        return;
+    for (size_t at = 0; at + sizeof(ScoreRecord) <= m.size; at += sizeof(ScoreRecord))
+    {
+        ScoreRecord r;
+        memcpy(&r, m.data + at, sizeof(r));
+        if (!scoreRecordValid(r))
+            continue;
+        scoreInsert(top, r);
+        records++;
+    }
+    unmapFile(m);
+}
+
+// Drops the part of a record a dead writer left at the end of the log.
+// Runs with the exclusive lock held.
+bool scoreCutTornTail(FILE *log)
+{
+    if (fseek(log, 0, SEEK_END) != 0)
+        return false;
+    long long size = ftell(log);
+    long long torn = size % (long long)sizeof(ScoreRecord);
+    return size >= 0 && (torn == 0 || truncateFile(log, size - torn));
+}
+
+struct ScoreStore
+{
+    string logPath;
+    string snapPath;
+    FILE *log;
+    mutex lock;
+    condition_variable flushed;
+    vector<ScoreRecord> top;
+    vector<ScoreRecord> pending;
+    uint64_t submitted;
+    uint64_t durable;
+    uint64_t failedFrom;
+    bool flushing;
+    long long logRecords;
+};
+
+ScoreStore scores;
+
+// Rewrites the snapshot from the current files and empties the log. Runs
+// with st.lock held; gives up quietly if another process holds the log.
+void scoreCompact(ScoreStore &st)
+{
+    if (!lockFile(st.log, true, false))
+        return;
+
+    vector<ScoreRecord> merged;
+    long long records;
+    scoreLoadSnapshot(st.snapPath, merged);
+    scoreLoadLog(st.logPath, merged, records);
+
+    string tmpPath = st.snapPath + ".tmp";
+    ScoreSnapHeader h;
+    memcpy(h.magic, "CGHS", 4);
+    h.version = 1;
+    h.count = (uint32_t)merged.size();
+    h.crc = crc32(merged.data(), merged.size() * sizeof(ScoreRecord));
+    FILE *f = fopen(tmpPath.c_str(), "wb");
+    bool ok = f != NULL && fwrite(&h, sizeof(h), 1, f) == 1 &&
+              fwrite(merged.data(), sizeof(ScoreRecord), merged.size(), f) == merged.size() && syncFile(f);
+    if (f != NULL)
+        ok = fclose(f) == 0 && ok;
+    if (ok && replaceFile(tmpPath.c_str(), st.snapPath.c_str()) && truncateFile(st.log, 0))
+        st.logRecords = 0;
+    unlockFile(st.log);
+
+    for (const ScoreRecord &r : merged)
+        scoreInsert(st.top, r);
+}
+
+// Loads the table for the menu and opens the log for appending. Without a
+// writable log the table still works for this session.
+void scoreOpen(ScoreStore &st, const char *path)
+{
+    st.logPath = string(path) + ".log";
+    st.snapPath = string(path) + ".snap";
+    st.submitted = st.durable = 0;
+    st.failedFrom = UINT64_MAX;
+    st.flushing = false;
+
+    scoreLoadSnapshot(st.snapPath, st.top);
+    scoreLoadLog(st.logPath, st.top, st.logRecords);
+
+    st.log = fopen(st.logPath.c_str(), "ab");
+    if (st.log == NULL)
+        return;
+    if (st.logRecords >= SCORE_COMPACT_RECORDS)
+        scoreCompact(st);
+}
+
+// Records a finished game and returns once it is on disk, or the write
+// failed. Returns the game's rank from 0, or -1 if it is not in the table.
+int scoreSubmit(ScoreStore &st, ScoreRecord r, bool &saved)
+{
+    r.reserved = 0;
+    r.crc = crc32(&r, offsetof(ScoreRecord, crc));
+
+    unique_lock<mutex> guard(st.lock);
+    int rank = scoreInsert(st.top, r);
+    saved = false;
+    if (st.log == NULL || st.failedFrom != UINT64_MAX)
+        return rank;
+
+    st.pending.push_back(r);
+    uint64_t ticket = ++st.submitted;
+    while (st.durable < ticket)
+    {
+        if (st.flushing)
+        {
+            st.flushed.wait(guard);
+            continue;
+        }
+        if (st.failedFrom != UINT64_MAX)
+        {
+            st.pending.clear();
+            break;
+        }
+
+        // Nobody is flushing: write out everything queued so far.
+        vector<ScoreRecord> batch;
+        batch.swap(st.pending);
+        uint64_t first = st.durable + 1;
+        uint64_t last = st.submitted;
+        st.flushing = true;
+        guard.unlock();
+
+        // stdio may split a large batch into several writes, so other
+        // processes are kept out until all of it is on disk.
+        bool ok = lockFile(st.log, true, true);
+        if (ok)
+        {
+            ok = scoreCutTornTail(st.log) &&
+                 fwrite(batch.data(), sizeof(ScoreRecord), batch.size(), st.log) == batch.size() && syncFile(st.log);
+            unlockFile(st.log);
+        }
+
+        guard.lock();
+        st.flushing = false;
+        st.durable = last;
+        if (!ok)
+            st.failedFrom = min(st.failedFrom, first);
+        if (ok)
+            st.logRecords += batch.size();
+        if (ok && st.logRecords >= SCORE_COMPACT_RECORDS)
+            scoreCompact(st);
+        st.flushed.notify_all();
+    }
+    saved = ticket < st.failedFrom;
+    return rank;
+}
+
+vector<ScoreRecord> scoreTop(ScoreStore &st, int n)
+{
+    lock_guard<mutex> guard(st.lock);
+    return vector<ScoreRecord>(st.top.begin(), st.top.begin() + min(n, (int)st.top.size()));
+}
+
+// GAME LOOP TIMING:
+// The simulation advances in fixed TICK_MS steps against absolute deadlines
+// on a monotonic clock, so render cost and sleep granularity never change
+// the game speed. A frame that wakes late runs extra steps to catch up.
+
+struct LoopStats
+{
+    long long frames;
+    long long steps;
+    long long catchupSteps;
+    long long droppedSteps;
+    double jitterSumMs;
+    double jitterSqSumMs;
+    double jitterMaxMs;
+};
+
+void recordJitter(LoopStats &ls, SteadyTime deadline, SteadyTime woke)
+{
+    double late = chrono::duration<double, milli>(woke - deadline).count();
+    ls.frames++;
+    ls.jitterSumMs += late;
+    ls.jitterSqSumMs += late * late;
+    if (late > ls.jitterMaxMs)
+        ls.jitterMaxMs = late;
+}
+
+// COMMAND LINE:
+
+struct Options
+{
+    bool haveSeed;
+    uint64_t seed;
+    bool stats;
+    int traffic;
+    bool benchCollision;
+    bool bench;
+    const char *benchOut;
+    long long simGames;
+    string policy;
+    int threads;
+    long long maxTicks;
+    const char *simOut;
+    bool autopilot;
+    bool practice;
+    const char *recordPath;
+    const char *replayPath;
+    long long seekTick;
+    const char *scoresPath;
+    int servePort;
+    int workers;
+    int botPort;
+    int bots;
+    int botSeconds;
+    int castPort;
+    bool selfTest;
+};
+
+Options options = {false, 0, false, DEFAULT_TRAFFIC, false, false, NULL, 0, "dodge", 0, 20000, "montecarlo.json",
+                   false, false, NULL, NULL, 0, "highscores", 0, 0, 0, 100, 10, 0, false};
+
+void usage(const char *prog)
+{
+    cout << "usage: " << prog << " [--seed N] [--traffic N] [--stats] [--autopilot] [--practice] [--record FILE]" << endl;
+    cout << "       " << prog << "  [--broadcast PORT]" << endl;
+    cout << "       " << prog << " --bench [--bench-out FILE] | --bench-collision | --selftest" << endl;
+    cout << "       " << prog << " --sim GAMES [--policy NAME] [--threads N] [--max-ticks N] [--sim-out FILE]" << endl;
+    cout << "       " << prog << " --replay FILE [--seek TICK]" << endl;
+    cout << "       " << prog << " --serve PORT [--workers N] | --bot PORT [--bots N] [--seconds S]" << endl;
+    cout << "  --seed N     start every game from seed N (reproducible runs)" << endl;
+    cout << "  --traffic N  allow up to N enemy cars on the road (default " << DEFAULT_TRAFFIC << ")" << endl;
+    cout << "  --stats      show frame timings in the side panel and print a summary on exit" << endl;
+    cout << "  --autopilot  let the computer drive, one game after another until esc" << endl;
+    cout << "  --practice   a crash rewinds two seconds instead of ending the game" << endl;
+    cout << "  --record FILE" << endl;
+    cout << "               save each game played as a replay in FILE (the latest game wins)" << endl;
+    cout << "  --replay FILE" << endl;
+    cout << "               watch a recorded game; a/d seek, space pauses, esc quits" << endl;
+    cout << "  --seek TICK  start the replay at TICK" << endl;
+    cout << "  --broadcast PORT" << endl;
+    cout << "               let viewers on 127.0.0.1:PORT watch the game or replay (Linux)" << endl;
+    cout << "  --scores PATH" << endl;
+    cout << "               keep the high-score table in PATH.log and PATH.snap (default highscores)" << endl;
+    cout << "  --bench      run the headless benchmark suite, print JSON and exit" << endl;
+    cout << "  --bench-out FILE" << endl;
+    cout << "               write the benchmark JSON to FILE instead of stdout" << endl;
+    cout << "  --bench-collision" << endl;
+    cout << "               compare the scalar and SIMD collision kernels and exit" << endl;
+    cout << "  --selftest   run the built-in consistency checks and exit" << endl;
+    cout << "  --sim GAMES  play GAMES headless games on all cores and write score histograms" << endl;
+    cout << "  --policy NAME" << endl;
+    cout << "               driver for --sim:";
+    for (const PolicyEntry &e : policies)
+        cout << " " << e.name;
+    cout << " (default dodge)" << endl;
+    cout << "  --threads N  worker threads for --sim (default: one per core)" << endl;
+    cout << "  --max-ticks N" << endl;
+    cout << "               end a --sim game that survives N ticks (default 20000)" << endl;
+    cout << "  --sim-out FILE" << endl;
+    cout << "               where --sim writes its JSON (default montecarlo.json)" << endl;
+    cout << "  --serve PORT host one game per TCP connection on 127.0.0.1:PORT (Linux)" << endl;
+    cout << "  --workers N  event loop threads for --serve (default: one per core)" << endl;
+    cout << "  --bot PORT   load-test a --serve instance with bots that press random keys" << endl;
+    cout << "  --bots N     connections opened by --bot (default 100)" << endl;
+    cout << "  --seconds S  how long --bot runs (default 10)" << endl;
+}
+
+bool parseOptions(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc)
+        {
+            options.haveSeed = true;
+            options.seed = strtoull(argv[++i], NULL, 0);
+        }
+        else if (arg == "--traffic" && i + 1 < argc)
+        {
+            options.traffic = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--stats")
+        {
+            options.stats = true;
+        }
+        else if (arg == "--autopilot")
+        {
+            options.autopilot = true;
+        }
+        else if (arg == "--practice")
+        {
+            options.practice = true;
+        }
+        else if (arg == "--record" && i + 1 < argc)
+        {
+            options.recordPath = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc)
+        {
+            options.replayPath = argv[++i];
+        }
+        else if (arg == "--seek" && i + 1 < argc)
+        {
+            options.seekTick = max(0LL, atoll(argv[++i]));
+        }
+        else if (arg == "--broadcast" && i + 1 < argc)
+        {
+            options.castPort = atoi(argv[++i]);
+        }
+        else if (arg == "--scores" && i + 1 < argc)
+        {
+            options.scoresPath = argv[++i];
+        }
+        else if (arg == "--bench")
+        {
+            options.bench = true;
+        }
+        else if (arg == "--bench-out" && i + 1 < argc)
+        {
+            options.benchOut = argv[++i];
+        }
+        else if (arg == "--sim" && i + 1 < argc)
+        {
+            options.simGames = max(1LL, atoll(argv[++i]));
+        }
+        else if (arg == "--policy" && i + 1 < argc && findPolicy(argv[i + 1]) != NULL)
+        {
+            options.policy = argv[++i];
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            options.threads = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--max-ticks" && i + 1 < argc)
+        {
+            options.maxTicks = max(1LL, atoll(argv[++i]));
+        }
+        else if (arg == "--sim-out" && i + 1 < argc)
+        {
+            options.simOut = argv[++i];
+        }
+        else if (arg == "--serve" && i + 1 < argc)
+        {
+            options.servePort = atoi(argv[++i]);
+        }
+        else if (arg == "--workers" && i + 1 < argc)
+        {
+            options.workers = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--bot" && i + 1 < argc)
+        {
+            options.botPort = atoi(argv[++i]);
+        }
+        else if (arg == "--bots" && i + 1 < argc)
+        {
+            options.bots = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--seconds" && i + 1 < argc)
+        {
+            options.botSeconds = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--bench-collision")
+        {
+            options.benchCollision = true;
+        }
+        else if (arg == "--selftest")
+        {
+            options.selfTest = true;
+        }
+        else
+        {
+            usage(argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// SOCKETS:
+// Shared by the game server and the spectator broadcaster, which are
+// Linux only like the epoll loops they feed.
+
+#ifdef __linux__
+
+void raiseFileLimit()
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+sockaddr_in loopbackAddress(int port)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return addr;
+}
+
+// A listening socket on 127.0.0.1. With shard set, several sockets can
+// bind the same port and the kernel spreads connections across them.
+int serverListen(int port, bool shard)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (shard)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    sockaddr_in addr = loopbackAddress(port);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends data[sent, size) on a non-blocking socket until it would block.
+// While anything is left, epoll also reports `tag` when the socket is
+// writable again; the interest is dropped once everything is sent.
+// Returns false if the connection is gone.
+bool sendPending(int epfd, int fd, void *tag, const char *data, size_t size, size_t &sent, bool &wantWrite)
+{
+    while (sent < size)
+    {
+        ssize_t n = send(fd, data + sent, size - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0)
+        {
+            sent += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            if (!wantWrite)
+            {
+                epoll_event ev;
+                ev.events = EPOLLIN | EPOLLOUT;
+                ev.data.ptr = tag;
+                epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+                wantWrite = true;
+            }
+            return true;
+        }
+        return false;
+    }
+    if (wantWrite)
+    {
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = tag;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+        wantWrite = false;
+    }
+    return true;
+}
+
+// Removes item from a list that each item knows its place in by moving
+// the last item into its slot.
+template <typename T>
+void swapRemove(vector<T *> &items, T *item)
+{
+    T *moved = items.back();
+    items[item->index] = moved;
+    moved->index = item->index;
+    items.pop_back();
+}
+
+#endif
+
+// SPECTATORS:
+// --broadcast PORT lets anyone on this machine watch the game, e.g. with
+// `nc 127.0.0.1 PORT`. The game loop encodes each frame once, against a
+// spectator encoder of its own, and hands the bytes to a broadcaster
+// thread through an SPSC ring; it never touches a viewer socket. The
+// broadcaster writes the same refcounted buffer to every viewer.
+//
+// Every CAST_KEYFRAME_FRAMES frames the game also encodes a full repaint.
+// A viewer that still has part of a frame unsent when the next one comes
+// is left out of the diffs and picks up again at the next keyframe, as
+// does a viewer that has just connected.
+
+struct CastFrame
+{
+    shared_ptr<const string> diff; // NULL when every viewer must resync
+    shared_ptr<const string> full; // NULL except on keyframes
+};
+
+#ifdef __linux__
+
+struct Viewer
+{
+    int fd;
+    int index;
+    shared_ptr<const string> pending;
+    size_t sent;
+    bool synced;
+    bool wantWrite;
+    bool dead;
+};
+
+SpscRing<CastFrame, CAST_RING_SIZE> castRing;
+FrameEncoder castDiff;
+FrameEncoder castFull;
+long long castFrames = 0;
+bool castLost = true;
+atomic<bool> castRunning(false);
+atomic<int> castViewers(0);
+thread castThread;
+int castListenFd = -1;
+int castWakeFd = -1;
+
+// Called by the game after composing a frame.
+void castFrame()
+{
+    if (!castRunning.load(memory_order_relaxed))
+        return;
+    if (castViewers.load(memory_order_relaxed) == 0)
+    {
+        // Nobody to encode for; whoever connects next starts from a full
+        // repaint.
+        castLost = true;
+        return;
+    }
+
+    // Viewers' terminals are not ours to resize; a new frame size simply
+    // gets everyone a full repaint.
+    if (castDiff.shown.width != frame.width || castDiff.shown.height != frame.height)
+        castLost = true;
+
+    CastFrame f;
+    encodeFrame(castDiff);
+    if (!castLost)
+        f.diff = make_shared<const string>(castDiff.out);
+    if (castLost || castFrames % CAST_KEYFRAME_FRAMES == 0)
+    {
+        invalidateFrame(castFull);
+        encodeFrame(castFull);
+        f.full = make_shared<const string>("\x1b[0m\x1b[2J\x1b[?25l" + castFull.out);
+    }
+    castFrames++;
+
+    // A full ring means the broadcaster is stalled; losing this diff is
+    // fine as long as the next frame makes everyone repaint.
+    castLost = !castRing.push(f);
+    if (!castLost)
+    {
+        uint64_t one = 1;
+        ssize_t ignored = write(castWakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+bool viewerFlush(int epfd, Viewer &v)
+{
+    // A frame can finish going out between epoll reporting the socket
+    // writable and that event being handled.
+    if (!v.pending)
+        return true;
+    if (!sendPending(epfd, v.fd, &v, v.pending->data(), v.pending->size(), v.sent, v.wantWrite))
+        return false;
+    if (v.sent == v.pending->size())
+        v.pending.reset();
+    return true;
+}
+
+// Hands one frame to a viewer. Returns false if the viewer is gone.
+bool viewerOffer(int epfd, Viewer &v, const CastFrame &f)
+{
+    if (v.pending)
+    {
+        // Still busy with an earlier frame: this diff is lost to it.
+        v.synced = false;
+        return true;
+    }
+    if (v.synced && f.diff)
+        v.pending = f.diff;
+    else if (f.full)
+        v.pending = f.full;
+    else
+        return true;
+    v.synced = true;
+    v.sent = 0;
+    return viewerFlush(epfd, v);
+}
+
+void viewerClose(vector<Viewer *> &viewers, Viewer *v)
+{
+    close(v->fd);
+    swapRemove(viewers, v);
+    delete v;
+    castViewers.store((int)viewers.size(), memory_order_relaxed);
+}
+
+void castMain()
+{
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &castListenFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, castListenFd, &ev);
+    ev.data.ptr = &castWakeFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, castWakeFd, &ev);
+
+    vector<Viewer *> viewers;
+    epoll_event events[SERVER_EVENTS];
+    while (castRunning.load(memory_order_acquire))
+    {
+        int n = epoll_wait(epfd, events, SERVER_EVENTS, -1);
+        for (int i = 0; i < n; i++)
+        {
+            void *tag = events[i].data.ptr;
+            if (tag == &castListenFd)
+            {
+                int fd;
+                while ((fd = accept4(castListenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                {
+                    Viewer *v = new Viewer();
+                    v->fd = fd;
+                    v->index = (int)viewers.size();
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = v;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+                    viewers.push_back(v);
+                }
+                castViewers.store((int)viewers.size(), memory_order_relaxed);
+            }
+            else if (tag == &castWakeFd)
+            {
+                uint64_t count;
+                ssize_t ignored = read(castWakeFd, &count, sizeof(count));
+                (void)ignored;
+                CastFrame f;
+                while (castRing.pop(f))
+                    for (Viewer *v : viewers)
+                        if (!v->dead && !viewerOffer(epfd, *v, f))
+                            v->dead = true;
+            }
+            else
+            {
+                // Viewers have nothing to say; read only to notice EOF.
+                Viewer *v = (Viewer *)tag;
+                if (v->dead)
+                    continue;
+                bool ok = (events[i].events & (EPOLLERR | EPOLLHUP)) == 0;
+                if (ok && (events[i].events & EPOLLIN))
+                {
+                    char buf[256];
+                    ssize_t got;
+                    while ((got = recv(v->fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+                        ;
+                    ok = got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+                }
+                if (ok && (events[i].events & EPOLLOUT))
+                    ok = viewerFlush(epfd, *v);
+                if (!ok)
+                    v->dead = true;
+            }
+        }
+
+        // Later events in the batch may still point at a viewer that
+        // failed, so viewers are only freed once the batch is done.
+        // Backwards, so a close swaps in one already checked.
+        for (int k = (int)viewers.size() - 1; k >= 0; k--)
+            if (viewers[k]->dead)
+                viewerClose(viewers, viewers[k]);
+    }
+
+    for (Viewer *v : viewers)
+    {
+        close(v->fd);
+        delete v;
+    }
+    close(epfd);
+}
+
+bool castStart(int port)
+{
+    raiseFileLimit();
+    castListenFd = serverListen(port, false);
+    castWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (castListenFd < 0 || castWakeFd < 0)
+        return false;
+    castRunning.store(true, memory_order_release);
+    castThread = thread(castMain);
+    return true;
+}
+
+void castStop()
+{
+    if (!castRunning.load(memory_order_relaxed))
+        return;
+    castRunning.store(false, memory_order_release);
+    uint64_t one = 1;
+    ssize_t ignored = write(castWakeFd, &one, sizeof(one));
+    (void)ignored;
+    castThread.join();
+    close(castListenFd);
+    close(castWakeFd);
+}
+
+int castViewerCount()
+{
+    return castViewers.load(memory_order_relaxed);
+}
+
+#else
+
+void castFrame()
+{
+}
+
+bool castStart(int)
+{
+    errno = ENOSYS;
+    return false;
+}
+
+void castStop()
+{
+}
+
+int castViewerCount()
+{
+    return 0;
+}
+
+#endif
+
+// SPRITES:
+// Vehicles are declared once as rows of text; spaces are transparent. The
+// sprite tables, transparency masks and the runs of opaque glyphs in each
+// row are all worked out at compile time, so drawing a sprite is one copy
+// per run. A new vehicle is a new atlas entry, not new draw code.
+
+#define SPRITE_MAX_W 16
+#define SPRITE_MAX_H 8
+#define SPRITE_MAX_RUNS 4
+
+struct GlyphRun
+{
+    int offset;
+    int length;
+};
+
+struct Sprite
+{
+    int width;
+    int height;
+    unsigned char attr;
+    char glyphs[SPRITE_MAX_H][SPRITE_MAX_W];
+    uint32_t opaque[SPRITE_MAX_H];
+    GlyphRun runs[SPRITE_MAX_H][SPRITE_MAX_RUNS];
+    int runCount[SPRITE_MAX_H];
+};
+
+template <int H>
+constexpr Sprite makeSprite(const char *const (&rows)[H], unsigned char attr)
+{
+    Sprite sp{};
+    sp.height = H;
+    sp.attr = attr;
+    for (int i = 0; i < H; i++)
+    {
+        int len = 0;
+        for (; rows[i][len] != '\0'; len++)
+        {
+            sp.glyphs[i][len] = rows[i][len];
+            if (rows[i][len] != ' ')
+                sp.opaque[i] |= 1u << len;
+        }
+        if (len > sp.width)
+            sp.width = len;
+
+        for (int j = 0; j < len;)
+        {
+            if (!((sp.opaque[i] >> j) & 1))
+            {
+                j++;
+                continue;
+            }
+            int start = j;
+            while (j < len && ((sp.opaque[i] >> j) & 1))
+                j++;
+            sp.runs[i][sp.runCount[i]++] = GlyphRun{start, j - start};
+        }
+    }
+    return sp;
+}
+
+enum SpriteId
+{
+    SPRITE_PLAYER,
+    SPRITE_ENEMY,
+    SPRITE_COUNT
+};
+
+constexpr const char *playerRows[] = {" ++ ",
+                                      "++++",
+                                      " ++ ",
+                                      "++++"};
+
+constexpr const char *enemyRows[] = {"****",
+                                     " **",
+                                     "****",
+                                     " **"};
+
+constexpr Sprite spriteAtlas[SPRITE_COUNT] = {
+    makeSprite(playerRows, DEFAULT_ATTR),
+    makeSprite(enemyRows, DEFAULT_ATTR),
+};
+
+static_assert(spriteAtlas[SPRITE_ENEMY].runCount[1] == 1 && spriteAtlas[SPRITE_ENEMY].runs[1][0].offset == 1,
+              "sprite runs must be computed at compile time");
+
+void blitSprite(const Sprite &sp, int x, int y)
+{
+    for (int i = 0; i < sp.height; i++)
+    {
+        int row = y + i;
+        if (row < 0 || row >= frame.height)
+            continue;
+        for (int r = 0; r < sp.runCount[i]; r++)
+        {
+            int from = x + sp.runs[i][r].offset;
+            int to = from + sp.runs[i][r].length;
+            int skip = from < 0 ? -from : 0;
+            if (to > frame.width)
+                to = frame.width;
+            if (from + skip >= to)
+                continue;
+            memcpy(&frame.ch(row)[from + skip], &sp.glyphs[i][sp.runs[i][r].offset + skip], to - from - skip);
+            memset(&frame.attr(row)[from + skip], sp.attr, to - from - skip);
+        }
+    }
+}
+
+// RENDERING:
+
+void drawEnemies(const GameState &s)
+{
+    const int32_t *ex = s.enemies.x();
+    const int32_t *ey = s.enemies.y();
+    const Sprite &sp = spriteAtlas[SPRITE_ENEMY];
+    poolForEach(s.enemies, [&](int i) {
+        blitSprite(sp, ex[i], ey[i]);
+    });
+}
+
+void drawCar(const GameState &s)
+{
+    blitSprite(spriteAtlas[SPRITE_PLAYER], s.carPos, s.road.carRow);
+}
+
+void updateScore(const GameState &s)
+{
+    char text[32];
+    snprintf(text, sizeof(text), "Score: %d", s.score);
+    putText(layout.panel + 7, 5, text);
+    snprintf(text, sizeof(text), "Speed: %.2f", (double)enemySpeed(s.score) / FP_ONE);
+    putText(layout.panel + 7, 6, text);
+}
+
+void gameover(const GameState &s, const LoopStats &ls)
+{
+    // Autopilot runs would crowd people out of the table.
+    int rank = -1;
+    bool saved = false;
+    if (!options.autopilot)
+    {
+        ScoreRecord r = {(int64_t)time(NULL), s.seed, s.tick, s.score, s.enemies.capacity, 0, 0};
+        rank = scoreSubmit(scores, r, saved);
+    }
+
+    double mean = ls.frames ? ls.jitterSumMs / ls.frames : 0.0;
+    double var = ls.frames ? ls.jitterSqSumMs / ls.frames - mean * mean : 0.0;
+    char timing[128];
+    snprintf(timing, sizeof(timing), "Frame jitter: mean %.2f ms, sd %.2f ms, max %.2f ms",
+             mean, var > 0 ? sqrt(var) : 0.0, ls.jitterMaxMs);
+
+    clearScreen();
+    cout << endl;
+    cout << "\t\t---------------------------------" << endl;
+    cout << "\t\t---------- Game Over :(----------" << endl;
+    cout << "\t\t---------------------------------" << endl
+         << endl;
+    cout << "\t\tYour score is " << s.score << "." << endl;
+    if (rank >= 0)
+        cout << "\t\tHigh score #" << rank + 1 << (saved ? "!" : " (could not be saved)") << endl;
+    cout << endl;
+    cout << "\t\tSeed: " << s.seed << endl;
+    cout << "\t\t" << timing << endl;
+    cout << "\t\tCatch-up steps: " << ls.catchupSteps << ", dropped: " << ls.droppedSteps << endl
+         << endl;
+    if (options.autopilot)
+    {
+        // Unattended runs just show the result for a moment and go again.
+        cout << "\t\tNext game in 3 seconds.";
+        sleepUntil(SteadyClock::now() + chrono::seconds(3));
+        return;
+    }
+    cout << "\t\tPress any key to go back to menu.";
+
+    readKey();
+}
+
+void drawLeaderboard(int x, int y)
+{
+    vector<ScoreRecord> best = scoreTop(scores, LEADERBOARD_ROWS);
+    gotoxy(x, y);
+    cout << "High Scores";
+    gotoxy(x, y + 1);
+    cout << "-----------";
+    if (best.empty())
+    {
+        gotoxy(x, y + 2);
+        cout << "No games yet";
+    }
+    for (size_t i = 0; i < best.size(); i++)
+    {
+        char date[16] = "";
+        char line[48];
+        time_t when = (time_t)best[i].time;
+        struct tm *t = localtime(&when);
+        if (t != NULL)
+            strftime(date, sizeof(date), "%Y-%m-%d", t);
+        snprintf(line, sizeof(line), "%d. %6d  %s", (int)i + 1, best[i].score, date);
+        gotoxy(x, y + 2 + (int)i);
+        cout << line;
+    }
+}
+
+void instructions()
+{
+    clearScreen();
+    cout << "Instructions:";
+    cout << "\n--------------------";
+    cout << "\n Avoid Cars by moving left or right. ";
+    cout << "\n\n Press 'a' or Left to move left";
+    cout << "\n\n Press 'd' or Right to move right";
+    cout << "\n\n Press 'r' to rewind one second";
+    cout << "\n\n Press 'p' to show frame timings";
+    cout << "\n\n Press 'esc' to exit";
+    cout << "\n\nPress any key to go back to menu.";
+
+    readKey();
+}
+
+// Timing overlay in the side panel below the key hints, toggled with 'p'.
+void drawStatsOverlay()
+{
+    const int x = layout.panel + 1;
+    const int y = 17;
+    char line[32];
+
+    if (!options.stats)
+        return;
+
+    putText(x, y, "     p50  p99  max");
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        const Histogram &h = profiler.phases[i];
+        char p50[8], p99[8], mx[8];
+        formatDuration(p50, sizeof(p50), histPercentile(h, 50));
+        formatDuration(p99, sizeof(p99), histPercentile(h, 99));
+        formatDuration(mx, sizeof(mx), h.maxValue);
+        snprintf(line, sizeof(line), "%-4s%5s%5s%5s", phaseNames[i], p50, p99, mx);
+        putText(x, y + 1 + i, line);
+    }
+    snprintf(line, sizeof(line), "out %5lldB %5lldc", screen.stats.bytesWritten, screen.stats.cellsChanged);
+    putText(x, y + 1 + PHASE_COUNT, line);
+}
+
+void renderGame(const GameState &s)
+{
+    restoreBackground();
+    drawCar(s);
+    drawEnemies(s);
+    updateScore(s);
+    drawStatsOverlay();
+    if (options.castPort > 0)
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "Viewers: %d", castViewerCount());
+        putText(layout.panel + 7, 10, text);
+    }
+}
+
+// Lays the screen out for `road` at the terminal's current size. A game
+// keeps its road when the window changes, so only the clipping changes:
+// if the frame shrank the terminal may have rewrapped it and is repainted,
+// otherwise the next present sends just the cells that differ.
+void relayout(const Road &road)
+{
+    int cols = 0, rows = 0;
+    termSize(cols, rows);
+    Layout l = layoutFor(road, cols, rows);
+    bool shrank = l.width < layout.width || l.height < layout.height;
+    setLayout(l);
+    if (shrank)
+    {
+        clearScreen();
+        invalidateFrame();
+    }
+}
+
+Input keyToInput(int ch)
+{
+    if (ch == 'a' || ch == 'A' || ch == KEY_LEFT)
+        return INPUT_LEFT;
+    if (ch == 'd' || ch == 'D' || ch == KEY_RIGHT)
+        return INPUT_RIGHT;
+    if (ch == KEY_ESC)
+        return INPUT_QUIT;
+    return INPUT_NONE;
+}
+
+void saveRecording(const ReplayRecorder &rec, const GameState &s)
+{
+    if (rec.enabled && !replaySave(rec, s, options.recordPath))
+        perror(options.recordPath);
+}
+
+// Plays one game; returns true if the player quit with esc rather than
+// crashing.
+bool play()
+{
+    GameState state;
+    Rng driver;
+    ReplayRecorder rec;
+    SnapshotRing ring;
+    ReplayMark marks[REWIND_TICKS];
+    int crashes = 0;
+    int cols = 0, rows = 0;
+    termSize(cols, rows);
+    resetGame(state, options.haveSeed ? options.seed : freshSeed(), options.traffic, roadFor(cols, rows));
+    rngSeed(driver, ~state.seed);
+    rec.enabled = options.recordPath != NULL;
+    recorderStart(rec, state);
+    ringInit(ring, REWIND_TICKS, options.traffic);
+    marks[ringPush(ring, state)] = recorderMark(rec);
+
+    // Going back in time also takes back the inputs recorded since, so a
+    // replay shows the timeline that was finally played.
+    auto rewind = [&](int ticks) {
+        int slot = ringRewind(ring, ticks, state);
+        if (slot >= 0)
+            recorderRewind(rec, marks[slot]);
+    };
+
+    relayout(state.road);
+    clearScreen();
+    invalidateFrame();
+    restoreBackground();
+    updateScore(state);
+    if (!options.autopilot)
+    {
+        putText(state.road.left + 1, 5, "Press any key to start :)");
+        presentFrame();
+        castFrame();
+        readKey();
+    }
+
+    const SteadyClock::duration tick = chrono::milliseconds(TICK_MS);
+    LoopStats ls = LoopStats();
+    SteadyTime next = SteadyClock::now();
+    profiler.enabled = true;
+    startInput();
+
+    while (1)
+    {
+        PhaseScope frameTiming(PHASE_FRAME);
+
+        // Every key read since the last frame is applied now; the oldest
+        // one decides how long the player waited to see a response.
+        bool quit = false;
+        bool haveKey = false;
+        SteadyTime oldestKey;
+        {
+            PhaseScope timing(PHASE_INPUT);
+            KeyEvent ev;
+            while (inputRing.pop(ev))
+            {
+                Input in = keyToInput(ev.key);
+                if (in == INPUT_QUIT)
+                    quit = true;
+                else if (ev.key == 'p' || ev.key == 'P')
+                    options.stats = !options.stats;
+                else if (ev.key == 'r' || ev.key == 'R')
+                    rewind(REWIND_STEP_TICKS);
+                else if (in != INPUT_NONE)
+                {
+                    recordInput(rec, state, in);
+                    steer(state, in);
+                }
+                if (!haveKey)
+                    oldestKey = ev.time;
+                haveKey = true;
+            }
+        }
+        if (quit)
+            break;
+
+        if (termResumed)
+        {
+            // Back from Ctrl-Z: the shell drew over us, so repaint it all.
+            termResumed = 0;
+            setcursor(0);
+            clearScreen();
+            invalidateFrame();
+        }
+        if (termTakeResize())
+            relayout(state.road);
+
+        int steps = 0;
+        SteadyTime now = SteadyClock::now();
+        while (now >= next && steps < MAX_CATCHUP_STEPS && !state.over)
+        {
+            Input in = options.autopilot ? policyAutopilot(state, driver) : INPUT_NONE;
+            recordInput(rec, state, in);
+            step(state, in);
+            recordTick(rec, state);
+            if (!state.over)
+                marks[ringPush(ring, state)] = recorderMark(rec);
+            next += tick;
+            steps++;
+        }
+        ls.steps += steps;
+        if (steps > 1)
+            ls.catchupSteps += steps - 1;
+        if (now >= next && !state.over)
+        {
+            // Too far behind to catch up: drop the backlog instead of
+            // spiralling, and resume from the current time.
+            ls.droppedSteps += (now - next) / tick + 1;
+            next = now + tick;
+        }
+
+        if (state.over && options.practice)
+        {
+            crashes++;
+            rewind(PRACTICE_REWIND_TICKS);
+        }
+
+        {
+            PhaseScope timing(PHASE_RENDER);
+            renderGame(state);
+            if (options.practice)
+            {
+                char text[32];
+                snprintf(text, sizeof(text), "Crashes: %d", crashes);
+                putText(layout.panel + 7, 7, text);
+            }
+            presentFrame();
+            castFrame();
+        }
+        if (haveKey && profiler.enabled)
+            histRecord(profiler.phases[PHASE_LATENCY], chrono::duration_cast<chrono::nanoseconds>(SteadyClock::now() - oldestKey).count());
+
+        if (state.over)
+        {
+            profiler.enabled = false;
+            stopInput();
+            saveRecording(rec, state);
+            gameover(state, ls);
+
+            return false;
+        }
+
+        PhaseScope sleepTiming(PHASE_SLEEP);
+        if (!waitInputUntil(next))
+            recordJitter(ls, next, SteadyClock::now());
+    }
+    profiler.enabled = false;
+    stopInput();
+    saveRecording(rec, state);
+    return true;
+}
+
+// Shows a recorded game at normal speed. 'a'/'d' (or the arrows) jump
+// REPLAY_SEEK_TICKS back or forward, space pauses, esc leaves.
+void watchReplay(ReplayPlayer &p)
+{
+    const SteadyClock::duration tick = chrono::milliseconds(TICK_MS);
+    bool paused = false;
+    char line[32];
+
+    replaySeek(p, options.seekTick);
+    relayout(p.state.road);
+    clearScreen();
+    invalidateFrame();
+    startInput();
+    SteadyTime next = SteadyClock::now();
+
+    while (1)
+    {
+        bool quit = false;
+        KeyEvent ev;
+        while (inputRing.pop(ev))
+        {
+            if (ev.key == KEY_ESC)
+                quit = true;
+            else if (ev.key == ' ')
+                paused = !paused;
+            else if (keyToInput(ev.key) == INPUT_LEFT)
+                replaySeek(p, p.state.tick - REPLAY_SEEK_TICKS);
+            else if (keyToInput(ev.key) == INPUT_RIGHT)
+                replaySeek(p, p.state.tick + REPLAY_SEEK_TICKS);
+        }
+        if (quit)
+            break;
+
+        if (termResumed)
+        {
+            termResumed = 0;
+            setcursor(0);
+            clearScreen();
+            invalidateFrame();
+        }
+        if (termTakeResize())
+            relayout(p.state.road);
+
+        SteadyTime now = SteadyClock::now();
+        if (paused || replayFinished(p) || now - next > tick * MAX_CATCHUP_STEPS)
+            next = now + tick;
+        while (now >= next)
+        {
+            replayStep(p);
+            next += tick;
+        }
+
+        renderGame(p.state);
+        snprintf(line, sizeof(line), "Tick %lld/%llu", p.state.tick, (unsigned long long)p.header.finalTick);
+        putText(layout.panel + 2, 7, line);
+        putText(layout.panel + 2, 8, replayFinished(p) ? "END" : paused ? "PAUSED" : "REPLAY");
+        putText(layout.panel + 2, 9, "A/D - seek, Space");
+        presentFrame();
+        castFrame();
+
+        waitInputUntil(next);
+    }
+    stopInput();
+}
+
+// BENCHMARKS:
+
+// Enemies stay above the car rows, so every call scans the whole pool.
+void fillBenchPool(EnemyPool &p, int count, Rng &rng)
+{
+    poolInit(p, count);
+    for (int i = 0; i < count; i++)
+        poolSpawn(p, spawnColumn(rng, classicRoad), (int)rngBounded(rng, classicRoad.carRow - HITBOX_H) << FP_SHIFT, ENEMY_SPEED);
+}
+
+double timeKernel(CollideKernel fn, const EnemyPool &p, Rect car)
+{
+    volatile int sink = 0;
+    long long calls = 0;
+    long long batch = max(1, 1000000 / p.capacity);
+    SteadyTime start = SteadyClock::now();
+    SteadyTime stop = start + chrono::milliseconds(200);
+    SteadyTime now;
+    do
+    {
+        for (long long k = 0; k < batch; k++)
+            sink = sink + fn(p.x(), p.y(), p.alive(), p.capacity, car);
+        calls += batch;
+        now = SteadyClock::now();
+    } while (now < stop);
+    return chrono::duration<double, nano>(now - start).count() / calls;
+}
+
+void benchCollision()
+{
+    struct
+    {
+        const char *name;
+        CollideKernel fn;
+    } kernels[3] = {{"scalar", collideScalar}, {NULL, NULL}, {NULL, NULL}};
+#ifdef COLLIDE_SIMD
+    kernels[1].name = "sse2";
+    kernels[1].fn = collideSse2;
+    if (cpuHasAvx2())
+    {
+        kernels[2].name = "avx2";
+        kernels[2].fn = collideAvx2;
+    }
+#endif
+
+    const int sizes[3] = {10, 1000, 100000};
+    Rect car = carRectAt(roadStart(classicRoad), classicRoad.carRow);
+    Rng rng;
+    rngSeed(rng, 1);
+
+    printf("%-8s %8s %12s %12s %8s\n", "kernel", "enemies", "ns/call", "enemies/ns", "speedup");
+    for (int n : sizes)
+    {
+        EnemyPool p;
+        fillBenchPool(p, n, rng);
+        double scalarNs = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            if (kernels[k].fn == NULL)
+                continue;
+            double ns = timeKernel(kernels[k].fn, p, car);
+            if (k == 0)
+                scalarNs = ns;
+            printf("%-8s %8d %12.1f %12.2f %7.2fx\n", kernels[k].name, n, ns, n / ns, scalarNs / ns);
+        }
+    }
+}
+
+// The suite below measures the hot paths headless and reports them as
+// JSON, one object per measurement, for tracking regressions over time.
+
+#define BENCH_MIN_MS 300
+
+struct BenchResult
+{
+    string name;
+    const char *sizeKey; // "traffic" or "enemies"
+    int size;
+    double perSecond;
+    double nsPerOp;
+    double bytesPerFrame;
+};
+
+// Runs fn(batch) in growing batches until BENCH_MIN_MS have passed and
+// returns operations per second.
+template <typename Fn>
+double measureRate(Fn fn)
+{
+    long long ops = 0;
+    long long batch = 1;
+    SteadyTime start = SteadyClock::now();
+    SteadyTime stop = start + chrono::milliseconds(BENCH_MIN_MS);
+    SteadyTime now;
+    do
+    {
+        fn(batch);
+        ops += batch;
+        if (batch < (1 << 20))
+            batch *= 2;
+        now = SteadyClock::now();
+    } while (now < stop);
+    return ops / chrono::duration<double>(now - start).count();
+}
+
+BenchResult benchStep(int traffic)
+{
+    GameState s;
+    resetGame(s, 1, traffic);
+    Rng policy;
+    rngSeed(policy, 2);
+    double rate = measureRate([&](long long n) {
+        for (long long k = 0; k < n; k++)
+        {
+            step(s, (Input)rngBounded(policy, 3));
+            if (s.over)
+                resetGame(s, s.seed + 1, traffic);
+        }
+    });
+    BenchResult r = {"step", "traffic", traffic, rate, 1e9 / rate, 0};
+    return r;
+}
+
+// One autopilot decision per tick of a game it is driving.
+BenchResult benchAutopilot(int traffic)
+{
+    GameState s;
+    Rng driver;
+    resetGame(s, 5, traffic);
+    double rate = measureRate([&](long long n) {
+        for (long long k = 0; k < n; k++)
+        {
+            step(s, policyAutopilot(s, driver));
+            if (s.over)
+                resetGame(s, s.seed + 1, traffic);
+        }
+    });
+    BenchResult r = {"autopilot", "traffic", traffic, rate, 1e9 / rate, 0};
+    return r;
+}
+
+// Env-steps per second of a VecEnv of 4096 games under random actions,
+// drawn ahead of time so the generator is not part of the cost.
+BenchResult benchVecEnv(int traffic)
+{
+    const int games = 4096;
+    const int batches = 64;
+    VecEnv v;
+    vecEnvInit(v, games, 6, traffic);
+    vector<Input> actions((size_t)games * batches);
+    Rng rng;
+    rngSeed(rng, 7);
+    for (Input &a : actions)
+        a = (Input)rngBounded(rng, 3);
+
+    long long calls = 0;
+    double rate = measureRate([&](long long n) {
+        for (long long k = 0; k < n; k++, calls++)
+            vecEnvStep(v, &actions[(size_t)(calls % batches) * games]);
+    });
+    BenchResult r = {"vecenv", "traffic", traffic, rate * games, 1e9 / (rate * games), 0};
+    return r;
+}
+
+// Cost of the per-tick rewind snapshot.
+BenchResult benchSnapshot(int traffic)
+{
+    GameState s;
+    SnapshotRing ring;
+    resetGame(s, 8, traffic);
+    ringInit(ring, REWIND_TICKS, traffic);
+    double rate = measureRate([&](long long n) {
+        for (long long k = 0; k < n; k++)
+            ringPush(ring, s);
+    });
+    BenchResult r = {"snapshot", "traffic", traffic, rate, 1e9 / rate, 0};
+    return r;
+}
+
+BenchResult benchCollisionKernel(int enemies)
+{
+    EnemyPool p;
+    Rng rng;
+    rngSeed(rng, 3);
+    fillBenchPool(p, enemies, rng);
+    Rect car = carRectAt(roadStart(classicRoad), classicRoad.carRow);
+    volatile int sink = 0;
+    double rate = measureRate([&](long long n) {
+        for (long long k = 0; k < n; k++)
+            sink = sink + collideKernel(p.x(), p.y(), p.alive(), p.capacity, car);
+    });
+    BenchResult r = {"collision", "enemies", enemies, rate, 1e9 / rate, 0};
+    return r;
+}
+
+// Composes and diff-encodes frames of a running game into screen.out, which
+// stands in for the terminal. The tick between frames is not timed.
+BenchResult benchRender(int traffic, bool fullRepaint)
+{
+    GameState s;
+    resetGame(s, 4, traffic);
+    invalidateFrame();
+    double busyNs = 0;
+    long long bytes = 0;
+    long long frames = 0;
+    measureRate([&](long long n) {
+        for (long long k = 0; k < n; k++)
+        {
+            step(s, INPUT_NONE);
+            if (s.over)
+                resetGame(s, s.seed + 1, traffic);
+            if (fullRepaint)
+                invalidateFrame();
+
+            SteadyTime t0 = SteadyClock::now();
+            renderGame(s);
+            encodeFrame();
+            busyNs += chrono::duration<double, nano>(SteadyClock::now() - t0).count();
+            bytes += screen.stats.bytesWritten;
+            frames++;
+        }
+    });
+    BenchResult r = {fullRepaint ? "render_full" : "render_diff", "traffic", traffic, 1e9 * frames / busyNs, busyNs / frames,
+                     (double)bytes / frames};
+    return r;
+}
 
-#define SCREEN_WIDTH 90
-#define SCREEN_HEIGHT 26
-#define WIN_WIDTH 70
+const char *collideKernelName()
+{
+#ifdef COLLIDE_SIMD
+    if (collideKernel == collideAvx2)
+        return "avx2";
+    if (collideKernel == collideSse2)
+        return "sse2";
+#endif
+    return "scalar";
+}
 
-using namespace std;
+int runBenchmarks()
+{
+    FILE *out = stdout;
+    if (options.benchOut != NULL && (out = fopen(options.benchOut, "w")) == NULL)
+    {
+        perror(options.benchOut);
+        return 1;
+    }
 
-HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
-COORD CursorPosition;
+    vector<BenchResult> results;
+    const int trafficLevels[3] = {DEFAULT_TRAFFIC, 100, 1000};
+    const int collisionSizes[4] = {10, 1000, 10000, 100000};
+    for (int t : trafficLevels)
+        results.push_back(benchStep(t));
+    for (int t : trafficLevels)
+        results.push_back(benchVecEnv(t));
+    for (int t : trafficLevels)
+        results.push_back(benchAutopilot(t));
+    for (int t : trafficLevels)
+        results.push_back(benchSnapshot(t));
+    for (int n : collisionSizes)
+        results.push_back(benchCollisionKernel(n));
+    for (int t : trafficLevels)
+    {
+        results.push_back(benchRender(t, false));
+        results.push_back(benchRender(t, true));
+    }
 
-int enemyX[3];
-int enemyY[3];
-int enemyFlag[3];
-char car[4][4] = {' ', '+', '+', ' ',
-                  '+', '+', '+', '+',
-                  ' ', '+', '+', ' ',
-                  '+', '+', '+', '+'};
+    fprintf(out, "{\n  \"kernel\": \"%s\",\n  \"tick_ms\": %d,\n  \"results\": [\n", collideKernelName(), TICK_MS);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &r = results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"%s\": %d, \"per_sec\": %.1f, \"ns_per_op\": %.2f",
+                r.name.c_str(), r.sizeKey, r.size, r.perSecond, r.nsPerOp);
+        if (r.bytesPerFrame > 0)
+            fprintf(out, ", \"bytes_per_frame\": %.1f", r.bytesPerFrame);
+        fprintf(out, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
 
-int carPos = WIN_WIDTH / 2;
-int score = 0;
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
 
-void gotoxy(int x, int y)
+// MONTE CARLO:
+// --sim plays many independent games and records how far each one got.
+// Game i always uses seed mixSeed(base + i), so the results depend only on
+// the options, never on the thread count or on which thread ran a game.
+//
+// Work is split with range stealing: each worker owns a range of game
+// indices packed as begin << 32 | end in one atomic word. The owner takes
+// SIM_CHUNK games at a time from the front; a worker that runs dry takes
+// the back half of a random victim's range. Both are a single CAS, so
+// workers never block and a run of long games on one core is shared out.
+
+#define SIM_CHUNK 32
+
+struct alignas(64) SimWorker
 {
-    CursorPosition.X = x;
-    CursorPosition.Y = y;
-    SetConsoleCursorPosition(console, CursorPosition);
-}
+    atomic<uint64_t> range;
+    Histogram score;
+    Histogram ticks;
+    double scoreSum;
+    double tickSum;
+    long long capped;
+    Rng rng;
+};
 
-void setcursor(bool visible, DWORD size)
+uint64_t packRange(uint32_t begin, uint32_t end)
 {
-    if (size == 0)
-        size = 20;
+    return ((uint64_t)begin << 32) | end;
+}
 
-    CONSOLE_CURSOR_INFO lpCursor;
-    lpCursor.bVisible = visible;
-    lpCursor.dwSize = size;
-    SetConsoleCursorInfo(console, &lpCursor);
+bool takeChunk(SimWorker &w, uint32_t &begin, uint32_t &end)
+{
+    uint64_t cur = w.range.load(memory_order_relaxed);
+    for (;;)
+    {
+        uint32_t lo = (uint32_t)(cur >> 32);
+        uint32_t hi = (uint32_t)cur;
+        if (lo >= hi)
+            return false;
+        uint32_t n = min<uint32_t>(SIM_CHUNK, hi - lo);
+        if (w.range.compare_exchange_weak(cur, packRange(lo + n, hi), memory_order_acq_rel))
+        {
+            begin = lo;
+            end = lo + n;
+            return true;
+        }
+    }
 }
 
-void drawBorder()
+// Moves the back half of some other worker's range into self. Only the
+// owner refills its own range and it is empty here, so a plain store is
+// enough once the CAS on the victim succeeds.
+bool stealWork(vector<SimWorker> &workers, int self)
 {
-    for (int i = 0; i < SCREEN_HEIGHT; i++)
+    int n = (int)workers.size();
+    int first = (int)rngBounded(workers[self].rng, n);
+    for (int k = 0; k < n; k++)
     {
-        for (int j = 0; j < 17; j++)
+        int v = (first + k) % n;
+        if (v == self)
+            continue;
+        uint64_t cur = workers[v].range.load(memory_order_relaxed);
+        for (;;)
         {
-            gotoxy(0 + j, i);
-            cout << "+";
-            gotoxy(WIN_WIDTH - j, i);
-            cout << "+";
+            uint32_t lo = (uint32_t)(cur >> 32);
+            uint32_t hi = (uint32_t)cur;
+            if (lo >= hi)
+                break;
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (workers[v].range.compare_exchange_weak(cur, packRange(lo, mid), memory_order_acq_rel))
+            {
+                workers[self].range.store(packRange(mid, hi), memory_order_release);
+                return true;
+            }
         }
     }
-    for (int i = 0; i < SCREEN_HEIGHT; i++)
+    return false;
+}
+
+void simGame(SimWorker &w, Policy policy, uint64_t seed)
+{
+    GameState s;
+    Rng driver;
+    resetGame(s, seed, options.traffic);
+    rngSeed(driver, ~seed);
+    while (!s.over && s.tick < options.maxTicks)
+        step(s, policy(s, driver));
+
+    if (!s.over)
+        w.capped++;
+    histRecord(w.score, s.score);
+    histRecord(w.ticks, s.tick);
+    w.scoreSum += s.score;
+    w.tickSum += s.tick;
+}
+
+void simWorkerMain(vector<SimWorker> &workers, int self, Policy policy, uint64_t base)
+{
+    SimWorker &w = workers[self];
+    uint32_t begin, end;
+    for (;;)
+    {
+        while (takeChunk(w, begin, end))
+            for (uint32_t i = begin; i < end; i++)
+                simGame(w, policy, mixSeed(base + i));
+        // Work in flight is never lost: whoever holds a range runs it, so
+        // once every range looks empty this worker has nothing left to do.
+        if (!stealWork(workers, self))
+            return;
+    }
+}
+
+void writeHistogramJson(FILE *out, const char *name, const Histogram &h, double sum, bool last)
+{
+    fprintf(out, "  \"%s\": {\"mean\": %.2f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu,\n", name,
+            h.total ? sum / h.total : 0.0, (unsigned long long)histPercentile(h, 50),
+            (unsigned long long)histPercentile(h, 90), (unsigned long long)histPercentile(h, 99),
+            (unsigned long long)h.maxValue);
+    // Each pair is [highest value in bucket, games].
+    fprintf(out, "    \"histogram\": [");
+    bool first = true;
+    for (int i = 0; i < HIST_BUCKETS; i++)
     {
-        gotoxy(SCREEN_WIDTH, i);
-        cout << "+";
+        if (h.counts[i] == 0)
+            continue;
+        fprintf(out, "%s[%llu, %llu]", first ? "" : ", ", (unsigned long long)min(histBucketValue(i), h.maxValue),
+                (unsigned long long)h.counts[i]);
+        first = false;
     }
+    fprintf(out, "]}%s\n", last ? "" : ",");
 }
 
-void genEnemy(int ind)
+void histMerge(Histogram &into, const Histogram &from)
 {
-    enemyX[ind] = 17 + rand() % (33);
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        into.counts[i] += from.counts[i];
+    into.total += from.total;
+    into.maxValue = max(into.maxValue, from.maxValue);
 }
 
-void drawEnemy(int ind)
+int runMonteCarlo()
 {
-    if (enemyFlag[ind] == true)
+    if (options.simGames > UINT32_MAX)
+    {
+        fprintf(stderr, "--sim: at most %u games per run\n", UINT32_MAX);
+        return 1;
+    }
+    FILE *out = fopen(options.simOut, "w");
+    if (out == NULL)
+    {
+        perror(options.simOut);
+        return 1;
+    }
+
+    Policy policy = findPolicy(options.policy);
+    uint64_t base = options.haveSeed ? options.seed : freshSeed();
+    int threadCount = options.threads > 0 ? options.threads : max(1, (int)thread::hardware_concurrency());
+    uint32_t games = (uint32_t)options.simGames;
+
+    vector<SimWorker> workers(threadCount);
+    for (int t = 0; t < threadCount; t++)
     {
-        gotoxy(enemyX[ind], enemyY[ind]);
-        cout << "****";
-        gotoxy(enemyX[ind], enemyY[ind] + 1);
-        cout << " **";
-        gotoxy(enemyX[ind], enemyY[ind] + 2);
-        cout << "****";
-        gotoxy(enemyX[ind], enemyY[ind] + 3);
-        cout << " **";
+        uint32_t lo = (uint32_t)((uint64_t)games * t / threadCount);
+        uint32_t hi = (uint32_t)((uint64_t)games * (t + 1) / threadCount);
+        workers[t].range.store(packRange(lo, hi));
+        rngSeed(workers[t].rng, t);
     }
+
+    SteadyTime start = SteadyClock::now();
+    vector<thread> threads;
+    for (int t = 1; t < threadCount; t++)
+        threads.push_back(thread(simWorkerMain, ref(workers), t, policy, base));
+    simWorkerMain(workers, 0, policy, base);
+    for (thread &t : threads)
+        t.join();
+    double seconds = chrono::duration<double>(SteadyClock::now() - start).count();
+
+    SimWorker &total = workers[0];
+    for (int t = 1; t < threadCount; t++)
+    {
+        histMerge(total.score, workers[t].score);
+        histMerge(total.ticks, workers[t].ticks);
+        total.scoreSum += workers[t].scoreSum;
+        total.tickSum += workers[t].tickSum;
+        total.capped += workers[t].capped;
+    }
+
+    fprintf(out, "{\n  \"policy\": \"%s\",\n  \"games\": %u,\n  \"traffic\": %d,\n  \"seed\": %llu,\n", options.policy.c_str(),
+            games, options.traffic, (unsigned long long)base);
+    fprintf(out, "  \"max_ticks\": %lld,\n  \"capped\": %lld,\n  \"threads\": %d,\n  \"seconds\": %.3f,\n", options.maxTicks,
+            total.capped, threadCount, seconds);
+    writeHistogramJson(out, "score", total.score, total.scoreSum, false);
+    writeHistogramJson(out, "ticks", total.ticks, total.tickSum, true);
+    fprintf(out, "}\n");
+    fclose(out);
+
+    printf("%u games (%s) in %.2fs on %d threads, %.0f games/s; mean score %.1f, %lld reached %lld ticks -> %s\n", games,
+           options.policy.c_str(), seconds, threadCount, games / seconds, total.scoreSum / games, total.capped,
+           options.maxTicks, options.simOut);
+    return 0;
+}
+
+// SELF TEST:
+// --selftest checks, headless and in about a second, properties that
+// break silently when the rules or a file layout change. Each check
+// prints one line; any failure makes the exit status non-zero. Files are
+// written to a fresh temporary directory, removed again at the end.
+
+string selfTestDir;
+
+string scratchPath(const char *name)
+{
+    return selfTestDir + "/" + name;
 }
 
-void eraseEnemy(int ind)
+// Fills a pool of `count` enemies scattered over the road and a little
+// beyond it, then frees every third one so the alive bits have holes.
+void fillTestPool(EnemyPool &p, int count, const Road &road, Rng &rng)
 {
-    if (enemyFlag[ind] == true)
+    poolInit(p, count);
+    for (int i = 0; i < count; i++)
     {
-        gotoxy(enemyX[ind], enemyY[ind]);
-        cout << "     ";
-        gotoxy(enemyX[ind], enemyY[ind] + 1);
-        cout << "     ";
-        gotoxy(enemyX[ind], enemyY[ind] + 2);
-        cout << "     ";
-        gotoxy(enemyX[ind], enemyY[ind] + 3);
-        cout << "     ";
+        int x = road.left - HITBOX_W + (int)rngBounded(rng, road.columns + 2 * HITBOX_W);
+        int y = -HITBOX_H + (int)rngBounded(rng, road.carRow + 2 * HITBOX_H);
+        poolSpawn(p, x, y * FP_ONE, ENEMY_SPEED);
     }
+    for (int i = 0; i < count; i += 3)
+        poolRelease(p, i);
 }
 
-void resetEnemy(int ind)
+// A random car-sized rectangle on or near the road.
+Rect testRect(const Road &road, Rng &rng)
 {
-    eraseEnemy(ind);
-    enemyY[ind] = 1;
-    genEnemy(ind);
+    Rect r = {road.left - HITBOX_W + (int)rngBounded(rng, road.columns + 2 * HITBOX_W),
+              -HITBOX_H + (int)rngBounded(rng, road.carRow + 2 * HITBOX_H), HITBOX_W, HITBOX_H};
+    return r;
 }
 
-void drawCar()
+// Every enemy the broadphase offers for a rectangle, after the exact test,
+// must be exactly the set a scan of the whole pool finds.
+bool selfTestBroadphase()
 {
-    for (int i = 0; i < 4; i++)
+    const int counts[4] = {2 * BROADPHASE_MIN, 200, 5000, 50000};
+    const Road roads[2] = {classicRoad, roadFor(203, 40)};
+    Rng rng;
+    rngSeed(rng, 9);
+    long long queries = 0, mismatches = 0;
+    for (const Road &road : roads)
     {
-        for (int j = 0; j < 4; j++)
+        for (int count : counts)
         {
-            gotoxy(j + carPos, i + 22);
-            cout << car[i][j];
+            EnemyPool p;
+            fillTestPool(p, count, road, rng);
+            Broadphase b;
+            broadphaseInit(b, road);
+            broadphaseBuild(b, p);
+            if (!b.built)
+                mismatches++;
+
+            const int32_t *ex = p.x();
+            const int32_t *ey = p.y();
+            for (int q = 0; q < 500; q++)
+            {
+                Rect r = testRect(road, rng);
+                vector<int> found, expect;
+                broadphaseQuery(b, r.x - HITBOX_W + 1, r.y - HITBOX_H + 1, r.x + r.w - 1, r.y + r.h - 1, [&](int i) {
+                    if (enemyOverlaps(ex[i], ey[i], r))
+                        found.push_back(i);
+                });
+                poolForEach(p, [&](int i) {
+                    if (enemyOverlaps(ex[i], ey[i], r))
+                        expect.push_back(i);
+                });
+                sort(found.begin(), found.end());
+                queries++;
+                if (found != expect)
+                    mismatches++;
+            }
         }
     }
+    printf("broadphase: %lld queries against a full scan, %lld mismatches\n", queries, mismatches);
+    return mismatches == 0;
 }
 
-void eraseCar()
+// The SIMD kernels must report the same first hit as the scalar one,
+// including for pool sizes that leave a partial vector at the end. Half of
+// the rectangles sit on an enemy, live or freed, so hits and the alive
+// mask are both exercised.
+bool selfTestCollideKernels()
 {
-    for (int i = 0; i < 4; i++)
+    vector<CollideKernel> kernels;
+    string names;
+#ifdef COLLIDE_SIMD
+    kernels.push_back(collideSse2);
+    names += " sse2";
+    if (cpuHasAvx2())
+    {
+        kernels.push_back(collideAvx2);
+        names += " avx2";
+    }
+#endif
+    if (kernels.empty())
+    {
+        printf("collision kernels: no SIMD kernel on this CPU, nothing to compare\n");
+        return true;
+    }
+
+    const int counts[6] = {1, 7, 9, 33, 1000, 100003};
+    Rng rng;
+    rngSeed(rng, 10);
+    long long calls = 0, mismatches = 0;
+    for (int count : counts)
     {
-        for (int j = 0; j < 4; j++)
+        EnemyPool p;
+        fillTestPool(p, count, classicRoad, rng);
+        for (int q = 0; q < 400; q++)
         {
-            gotoxy(j + carPos, i + 22);
-            cout << " ";
+            Rect r = testRect(classicRoad, rng);
+            if (q & 1)
+            {
+                int i = (int)rngBounded(rng, count);
+                r.x = p.x()[i] + (int)rngBounded(rng, HITBOX_W) - 2;
+                r.y = p.y()[i] + (int)rngBounded(rng, HITBOX_H) - 2;
+            }
+            int expect = collideScalar(p.x(), p.y(), p.alive(), p.capacity, r);
+            for (CollideKernel fn : kernels)
+            {
+                calls++;
+                if (fn(p.x(), p.y(), p.alive(), p.capacity, r) != expect)
+                    mismatches++;
+            }
         }
     }
+    printf("collision kernels:%s against scalar, %lld calls, %lld mismatches\n", names.c_str(), calls, mismatches);
+    return mismatches == 0;
+}
+
+bool sameState(const GameState &a, const GameState &b)
+{
+    return a.tick == b.tick && a.seed == b.seed && a.rng.state == b.rng.state && a.rng.inc == b.rng.inc &&
+           a.carPos == b.carPos && a.score == b.score && a.over == b.over && a.spawnWave == b.spawnWave &&
+           a.sinceSpawn == b.sinceSpawn && a.enemies.live == b.enemies.live && a.enemies.freeTop == b.enemies.freeTop &&
+           a.enemies.block == b.enemies.block;
+}
+
+// The vector env fills the lowest free slot where a pool reuses the last
+// one freed, so enemies are compared as sorted (fy, x, vy) keys.
+vector<int64_t> enemyKeys(const GameState &s)
+{
+    vector<int64_t> keys;
+    const EnemyPool &p = s.enemies;
+    poolForEach(p, [&](int i) {
+        keys.push_back((int64_t)p.fy()[i] * (1 << 24) + p.x()[i] * (1 << 12) + p.vy()[i]);
+    });
+    sort(keys.begin(), keys.end());
+    return keys;
+}
+
+vector<int64_t> enemyKeys(const VecEnv &v, int g)
+{
+    vector<int64_t> keys;
+    for (int k = 0; k < v.capacity; k++)
+    {
+        size_t j = (size_t)k * v.stride + g;
+        if (v.alive[j])
+            keys.push_back((int64_t)v.fy[j] * (1 << 24) + v.ex[j] * (1 << 12) + v.vy[j]);
+    }
+    sort(keys.begin(), keys.end());
+    return keys;
 }
 
-int collision()
+bool selfTestVecEnv()
 {
-    if (enemyY[0] + 4 >= 23)
+    const int games = 64;
+    const int trafficLevels[4] = {1, 2, 5, 40};
+    long long compared = 0, mismatches = 0;
+    for (int traffic : trafficLevels)
     {
-        if (enemyX[0] + 4 - carPos >= 0 && enemyX[0] + 4 - carPos < 9)
+        // One level on a wide road, so the layout is covered too.
+        Road road = traffic == 5 ? roadFor(203, 40) : classicRoad;
+        VecEnv v;
+        vecEnvInit(v, games, 99, traffic, road);
+        vector<GameState> scalar(games);
+        uint64_t started = 0;
+        for (GameState &s : scalar)
+            resetGame(s, mixSeed(99 + started++), traffic, road);
+
+        Rng driver;
+        rngSeed(driver, traffic);
+        vector<Input> actions(games);
+        for (int t = 0; t < 2000; t++)
         {
-            return 1;
+            for (int g = 0; g < games; g++)
+                actions[g] = rngBounded(driver, 10) ? policyDodge(scalar[g], driver) : (Input)rngBounded(driver, 3);
+            vecEnvStep(v, actions.data());
+            for (int g = 0; g < games; g++)
+            {
+                GameState &s = scalar[g];
+                step(s, actions[g]);
+                bool same = s.over == (v.done[g] != 0) && (!s.over || s.score == v.finalScore[g]);
+                if (s.over)
+                    resetGame(s, mixSeed(99 + started++), traffic, road);
+                same = same && s.carPos == v.carPos[g] && s.score == v.score[g] && s.tick == v.tick[g] &&
+                       s.seed == v.seed[g] && s.enemies.live == v.enemyCount[g] && enemyKeys(s) == enemyKeys(v, g);
+                compared++;
+                if (!same)
+                    mismatches++;
+            }
         }
     }
-    return 0;
+    printf("vector env: %lld game steps compared with step(), %lld mismatches\n", compared, mismatches);
+    return mismatches == 0;
 }
 
-void gameover()
+// Plays a recorded game back from the start and checks it ends where the
+// recording did.
+bool replayEndsAt(const char *path, const GameState &end)
 {
-    system("cls");
-    cout << endl;
-    cout << "\t\t---------------------------------" << endl;
-    cout << "\t\t---------- Game Over :(----------" << endl;
-    cout << "\t\t---------------------------------" << endl
-         << endl;
-    cout << "\t\tYour score is " << score << "." << endl
-         << endl;
-    cout << "\t\tPress any key to go back to menu.";
+    ReplayPlayer p;
+    if (!replayOpen(p, path))
+        return false;
+    replaySeek(p, 0);
+    while (!replayFinished(p))
+        replayStep(p);
+    replayStep(p);
+    bool same = sameState(p.state, end);
+    replayClose(p);
+    return same;
+}
 
-    getch();
+bool selfTestReplay()
+{
+    const int trafficLevels[3] = {2, 4, 9};
+    string file = scratchPath("replay");
+    const char *path = file.c_str();
+    long long games = 0, seeks = 0, mismatches = 0;
+    for (int traffic : trafficLevels)
+    {
+        for (int k = 0; k < 10; k++)
+        {
+            GameState s;
+            Rng driver;
+            rngSeed(driver, k * 7 + traffic);
+            resetGame(s, 1000 + k, traffic);
+            ReplayRecorder rec;
+            rec.enabled = true;
+            recorderStart(rec, s);
+
+            // starts[t] is the state at the start of tick t, before its
+            // inputs, which is where replaySeek() leaves a game. The
+            // autopilot games run past several keyframes.
+            vector<GameState> starts(1, s);
+            long long limit = k % 3 == 0 ? 1500 : 4000;
+            while (!s.over && s.tick < limit)
+            {
+                Input in = (k & 1) ? policyAutopilot(s, driver) : policyDodge(s, driver);
+                // Some moves land between ticks, as keys do in play().
+                if (in != INPUT_NONE && rngBounded(driver, 4) == 0)
+                {
+                    recordInput(rec, s, in);
+                    steer(s, in);
+                    in = INPUT_NONE;
+                }
+                recordInput(rec, s, in);
+                step(s, in);
+                recordTick(rec, s);
+                if (!s.over)
+                    starts.push_back(s);
+            }
+            games++;
+            if (!replaySave(rec, s, path) || !replayEndsAt(path, s))
+            {
+                mismatches++;
+                continue;
+            }
+
+            ReplayPlayer p;
+            replayOpen(p, path);
+            for (int n = 0; n < 40; n++)
+            {
+                long long tick = rngBounded(driver, (uint32_t)starts.size());
+                replaySeek(p, tick);
+                seeks++;
+                if (!sameState(p.state, starts[tick]))
+                    mismatches++;
+            }
+            replayClose(p);
+        }
+    }
+    remove(path);
+    printf("replays: %lld games recorded, %lld seeks, %lld mismatches\n", games, seeks, mismatches);
+    return mismatches == 0;
 }
 
-void updateScore()
+// Plays games with rewinds as play() does them, checks each rewind lands
+// on the state first played at that tick, and that the cut-back recording
+// replays and seeks like the game as finally played.
+bool selfTestRewind()
 {
-    gotoxy(WIN_WIDTH + 7, 5);
-    cout << "Score: " << score << endl;
+    const int trafficLevels[3] = {2, 4, 9};
+    string file = scratchPath("replay");
+    const char *path = file.c_str();
+    long long rewinds = 0, mismatches = 0;
+    for (int traffic : trafficLevels)
+    {
+        for (int k = 0; k < 8; k++)
+        {
+            GameState s;
+            Rng driver;
+            rngSeed(driver, k);
+            resetGame(s, 77 + k, traffic);
+            ReplayRecorder rec;
+            rec.enabled = true;
+            recorderStart(rec, s);
+            SnapshotRing ring;
+            ringInit(ring, REWIND_TICKS, traffic);
+            ReplayMark marks[REWIND_TICKS];
+            marks[ringPush(ring, s)] = recorderMark(rec);
+            vector<GameState> played(1, s);
+            long long newest = 0;
+
+            // The ring holds one snapshot per tick, so a rewind goes back
+            // exactly `ticks` from the newest, or to the oldest kept. The
+            // recording is only cut back once the restore checks out.
+            auto rewind = [&](int ticks) {
+                long long expect = newest - min(ticks, ring.count - 1);
+                int slot = ringRewind(ring, ticks, s);
+                if (s.tick != expect || !sameState(s, played[s.tick]))
+                    return false;
+                recorderRewind(rec, marks[slot]);
+                newest = s.tick;
+                rewinds++;
+                return true;
+            };
+
+            bool ok = true;
+            for (int t = 0; ok && t < 4000 && !s.over; t++)
+            {
+                if (rngBounded(driver, 200) == 0)
+                    ok = rewind(rngBounded(driver, REWIND_TICKS + 30));
+                Input in = policyAutopilot(s, driver);
+                if (rngBounded(driver, 100) == 0)
+                    in = (Input)(1 + rngBounded(driver, 2));
+                recordInput(rec, s, in);
+                step(s, in);
+                recordTick(rec, s);
+                if (!s.over)
+                {
+                    marks[ringPush(ring, s)] = recorderMark(rec);
+                    newest = s.tick;
+                    played.resize(s.tick + 1);
+                    played[s.tick] = s;
+                }
+                else if (k & 1)
+                {
+                    // Practice mode, which keeps odd games going past
+                    // several replay keyframes.
+                    ok = rewind(PRACTICE_REWIND_TICKS);
+                }
+            }
+            if (!ok || !replaySave(rec, s, path) || !replayEndsAt(path, s))
+            {
+                mismatches++;
+                continue;
+            }
+
+            // Seeks use the keyframes, which must be the ones of the game
+            // as finally played.
+            ReplayPlayer p;
+            replayOpen(p, path);
+            for (int n = 0; n < 20; n++)
+            {
+                long long tick = rngBounded(driver, (uint32_t)played.size());
+                replaySeek(p, tick);
+                if (!sameState(p.state, played[tick]))
+                    mismatches++;
+            }
+            replayClose(p);
+        }
+    }
+    remove(path);
+    printf("rewind: %lld rewinds, %lld mismatches\n", rewinds, mismatches);
+    return mismatches == 0;
 }
 
-void instructions()
+void removeScoreFiles(const string &base)
 {
-    system("cls");
-    cout << "Instructions:";
-    cout << "\n--------------------";
-    cout << "\n Avoid Cars by moving left or right. ";
-    cout << "\n\n Press 'a' to move left";
-    cout << "\n\n Press 'd' to move right";
-    cout << "\n\n Press 'esc' to exit";
-    cout << "\n\nPress any key to go back to menu.";
+    remove((base + ".log").c_str());
+    remove((base + ".snap").c_str());
+    remove((base + ".snap.tmp").c_str());
+}
 
-    getch();
+// Opens the table afresh, as a new process would, and compares it with the
+// best of `expect`.
+bool scoreTableIs(const string &base, vector<ScoreRecord> expect)
+{
+    ScoreStore st;
+    scoreOpen(st, base.c_str());
+    if (st.log != NULL)
+        fclose(st.log);
+    sort(expect.begin(), expect.end(), scoreBetter);
+    expect.resize(min((int)expect.size(), SCORES_KEPT));
+    bool same = st.top.size() == expect.size();
+    for (size_t i = 0; same && i < expect.size(); i++)
+        same = st.top[i].score == expect[i].score && st.top[i].seed == expect[i].seed && st.top[i].time == expect[i].time;
+    return same;
 }
 
-void play()
+void appendFile(const string &path, const void *data, size_t size)
 {
-    carPos = -1 + WIN_WIDTH / 2;
-    score = 0;
-    enemyFlag[0] = 1;
-    enemyFlag[1] = 0;
-    enemyY[0] = enemyY[1] = 1;
+    FILE *f = fopen(path.c_str(), "ab");
+    if (f == NULL)
+        return;
+    fwrite(data, 1, size, f);
+    fclose(f);
+}
 
-    system("cls");
-    drawBorder();
-    updateScore();
-    genEnemy(0);
-    genEnemy(1);
-
-    gotoxy(WIN_WIDTH + 7, 2);
-    cout << "CAR GAME";
-    gotoxy(WIN_WIDTH + 6, 4);
-    cout << "----------";
-    gotoxy(WIN_WIDTH + 6, 4);
-    cout << "----------";
-    gotoxy(WIN_WIDTH + 7, 12);
-    cout << "Control ";
-    gotoxy(WIN_WIDTH + 7, 13);
-    cout << "--------- ";
-    gotoxy(WIN_WIDTH + 2, 14);
-    cout << " A key - Left";
-    gotoxy(WIN_WIDTH + 2, 15);
-    cout << " D key - Right";
-
-    gotoxy(18, 5);
-    cout << "Press any key to start :)";
-
-    getch();
-
-    gotoxy(18, 5);
-    cout << "                         ";
+bool selfTestScores()
+{
+    string base = scratchPath("scores");
+    string logPath = base + ".log";
+    vector<ScoreRecord> all;
+    for (int i = 0; i < 400; i++)
+    {
+        ScoreRecord r = {1700000000 + i, (uint64_t)i, i * 3, (i * 7919) % 5000, DEFAULT_TRAFFIC, 0, 0};
+        all.push_back(r);
+    }
 
-    while (1)
+    // Two stores on the same files stand in for two game processes, with
+    // two submitters each so some writes share a flush. 400 records also
+    // go past SCORE_COMPACT_RECORDS, so snapshots are written meanwhile.
+    bool allSaved = true;
+    {
+        ScoreStore st[2];
+        scoreOpen(st[0], base.c_str());
+        scoreOpen(st[1], base.c_str());
+        vector<thread> threads;
+        atomic<int> unsaved(0);
+        for (int t = 0; t < 4; t++)
+            threads.push_back(thread([&, t] {
+                for (int i = t; i < (int)all.size(); i += 4)
+                {
+                    bool saved;
+                    scoreSubmit(st[t & 1], all[i], saved);
+                    if (!saved)
+                        unsaved++;
+                }
+            }));
+        for (thread &th : threads)
+            th.join();
+        for (ScoreStore &one : st)
+        {
+            allSaved = allSaved && one.log != NULL;
+            if (one.log != NULL)
+                fclose(one.log);
+        }
+        allSaved = allSaved && unsaved.load() == 0;
+    }
+    bool reloaded = scoreTableIs(base, all);
+
+    // A writer that died mid-append leaves part of a record, or a whole
+    // one that only partly reached the disk, and other processes append
+    // after it. The damaged record must not load, nor hide the ones after.
+    bool tornRecords = false;
+    {
+        ScoreStore st;
+        scoreOpen(st, base.c_str());
+        const char torn[15] = "partial record";
+        appendFile(logPath, torn, sizeof(torn));
+        ScoreRecord late = {1800000000, 1, 1, 9000, DEFAULT_TRAFFIC, 0, 0};
+        bool lateSaved;
+        scoreSubmit(st, late, lateSaved);
+        all.push_back(late);
+
+        ScoreRecord lost = {1800000000, 3, 1, 9999, DEFAULT_TRAFFIC, 0, 0};
+        appendFile(logPath, &lost, sizeof(lost));
+        ScoreRecord later = {1800000001, 2, 1, 9001, DEFAULT_TRAFFIC, 0, 0};
+        bool laterSaved;
+        scoreSubmit(st, later, laterSaved);
+        all.push_back(later);
+        if (st.log != NULL)
+            fclose(st.log);
+        tornRecords = lateSaved && laterSaved && scoreTableIs(base, all);
+    }
+
+    // A crash between replacing the snapshot and emptying the log leaves
+    // the same records in both.
+    MappedFile snap;
+    bool duplicates = false;
+    if (mapFile((base + ".snap").c_str(), snap))
+    {
+        appendFile(logPath, snap.data + sizeof(ScoreSnapHeader), snap.size - sizeof(ScoreSnapHeader));
+        unmapFile(snap);
+        duplicates = scoreTableIs(base, all);
+    }
+    removeScoreFiles(base);
+
+    printf("scores: %s, reload %s, torn records %s, duplicates %s\n", allSaved ? "all saved" : "NOT SAVED",
+           reloaded ? "ok" : "BAD", tornRecords ? "ok" : "BAD", duplicates ? "ok" : "BAD");
+    return allSaved && reloaded && tornRecords && duplicates;
+}
+
+int runSelfTest()
+{
+    selfTestDir = makeTempDir();
+    if (selfTestDir.empty())
+    {
+        fprintf(stderr, "selftest: cannot create a temporary directory\n");
+        return 1;
+    }
+    SteadyTime start = SteadyClock::now();
+    bool ok = selfTestBroadphase();
+    ok = selfTestCollideKernels() && ok;
+    ok = selfTestVecEnv() && ok;
+    ok = selfTestReplay() && ok;
+    ok = selfTestRewind() && ok;
+    ok = selfTestScores() && ok;
+    removeDir(selfTestDir);
+    double seconds = chrono::duration<double>(SteadyClock::now() - start).count();
+    printf("selftest %s in %.2fs\n", ok ? "passed" : "FAILED", seconds);
+    return ok ? 0 : 1;
+}
+
+// GAME SERVER:
+// --serve hosts one game per TCP connection on 127.0.0.1. Each worker
+// thread owns a listening socket bound with SO_REUSEPORT, so the kernel
+// spreads new connections across workers, plus its own epoll set and
+// sessions; workers share nothing. Keys steer a game as soon as they are
+// read. Every TICK_MS a worker steps all of its games, draws each into the
+// thread's frame and queues the diff against that session's encoder.
+//
+// A client that cannot keep up is not sent more frames until its backlog
+// drains. Nothing is lost by skipping: the next diff is taken against what
+// was last queued, so it still lands on a correct screen. --bot drives
+// many connections from one process for load tests.
+
+#ifdef __linux__
+
+struct Session
+{
+    int fd;
+    int index;
+    GameState game;
+    FrameEncoder enc;
+    string backlog;
+    size_t sent;
+    bool wantWrite;
+    int escState;
+    SteadyTime escDeadline;
+};
+
+struct ServerWorker
+{
+    int epfd;
+    int listenFd;
+    vector<Session *> sessions;
+    // Read by the report loop in runServer().
+    atomic<int> live;
+    atomic<long long> frames;
+    atomic<long long> bytes;
+    atomic<long long> skipped;
+    atomic<long long> lateTicks;
+    atomic<long long> slowestTickNs;
+};
+
+void sessionStart(Session &s)
+{
+    resetGame(s.game, options.haveSeed ? options.seed : freshSeed(), options.traffic);
+    s.backlog += "\x1b[0m\x1b[2J\x1b[?25l";
+    invalidateFrame(s.enc);
+}
+
+// Sends as much of the backlog as the socket takes. Returns false if the
+// connection is gone.
+bool sessionFlush(ServerWorker &w, Session &s)
+{
+    if (!sendPending(w.epfd, s.fd, &s, s.backlog.data(), s.backlog.size(), s.sent, s.wantWrite))
+        return false;
+    if (s.sent == s.backlog.size())
+    {
+        s.backlog.clear();
+        s.sent = 0;
+    }
+    return true;
+}
+
+// Returns false when the player leaves.
+bool sessionKey(Session &s, int key)
+{
+    if (key == KEY_ESC)
+        return false;
+    if (s.game.over)
+        sessionStart(s);
+    else
+        steer(s.game, keyToInput(key));
+    return true;
+}
+
+// Decodes keys the way termReadKey() does, except that a sequence split
+// across reads is carried over in escState: 0 plain, 1 after ESC, 2 inside
+// a CSI. An ESC that is still alone ESC_TIMEOUT_MS after it arrived is the
+// escape key; serverTick() catches one the client sent nothing after.
+bool sessionRead(Session &s)
+{
+    unsigned char buf[256];
+    for (;;)
     {
-        if (kbhit())
+        ssize_t n = recv(s.fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n == 0)
+            return false;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return false;
+            return true;
+        }
+        // Too late to start a sequence: the ESC was a key press.
+        if (s.escState == 1 && SteadyClock::now() >= s.escDeadline)
+            return sessionKey(s, KEY_ESC);
+        for (ssize_t i = 0; i < n; i++)
         {
-            char ch = getch();
-            if (ch == 'a' || ch == 'A')
+            int c = buf[i];
+            if (s.escState == 2)
             {
-                if (carPos > 18)
-                    carPos -= 4;
+                if (c >= 0x20 && c < 0x40)
+                    continue;
+                s.escState = 0;
+                if (c == 'C' && !sessionKey(s, KEY_RIGHT))
+                    return false;
+                if (c == 'D' && !sessionKey(s, KEY_LEFT))
+                    return false;
+                continue;
             }
-            if (ch == 'd' || ch == 'D')
+            if (s.escState == 1)
             {
-                if (carPos < 50)
-                    carPos += 4;
+                s.escState = 0;
+                if (c == '[' || c == 'O')
+                {
+                    s.escState = 2;
+                    continue;
+                }
+                if (!sessionKey(s, KEY_ESC))
+                    return false;
             }
-            if (ch == 27)
+            if (c == KEY_ESC)
             {
-                break;
+                s.escState = 1;
+                s.escDeadline = SteadyClock::now() + chrono::milliseconds(ESC_TIMEOUT_MS);
             }
+            else if (!sessionKey(s, c))
+                return false;
+        }
+    }
+}
+
+void sessionClose(ServerWorker &w, Session *s)
+{
+    close(s->fd);
+    swapRemove(w.sessions, s);
+    delete s;
+    w.live.fetch_sub(1, memory_order_relaxed);
+}
+
+void serverAccept(ServerWorker &w)
+{
+    for (;;)
+    {
+        int fd = accept4(w.listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        Session *s = new Session();
+        s->fd = fd;
+        s->index = (int)w.sessions.size();
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = s;
+        epoll_ctl(w.epfd, EPOLL_CTL_ADD, fd, &ev);
+        w.sessions.push_back(s);
+        w.live.fetch_add(1, memory_order_relaxed);
+        sessionStart(*s);
+    }
+}
+
+void drawSessionOver(const GameState &s)
+{
+    char line[40];
+    snprintf(line, sizeof(line), "GAME OVER   Score: %d", s.score);
+    putText(s.road.left + 6, 10, line);
+    putText(s.road.left + 6, 12, "any key: again  esc: quit");
+}
+
+void serverTick(ServerWorker &w)
+{
+    long long frames = 0, bytes = 0, skipped = 0;
+    SteadyTime now = SteadyClock::now();
+    // Backwards, so a session closed here swaps in one already done.
+    for (int i = (int)w.sessions.size() - 1; i >= 0; i--)
+    {
+        Session &s = *w.sessions[i];
+        if (s.escState == 1 && now >= s.escDeadline)
+        {
+            sessionClose(w, &s);
+            continue;
         }
+        if (!s.game.over)
+            step(s.game, INPUT_NONE);
+        if (s.backlog.size() - s.sent >= SESSION_BACKLOG_MAX)
+        {
+            skipped++;
+            continue;
+        }
+        renderGame(s.game);
+        if (s.game.over)
+            drawSessionOver(s.game);
+        encodeFrame(s.enc);
+        s.backlog += s.enc.out;
+        frames++;
+        bytes += s.enc.out.size();
+        if (!s.wantWrite && !sessionFlush(w, s))
+            sessionClose(w, &s);
+    }
+    w.frames.fetch_add(frames, memory_order_relaxed);
+    w.bytes.fetch_add(bytes, memory_order_relaxed);
+    w.skipped.fetch_add(skipped, memory_order_relaxed);
+}
 
-        drawCar();
-        drawEnemy(0);
-        drawEnemy(1);
+void serverWorkerMain(ServerWorker &w)
+{
+    const SteadyClock::duration tick = chrono::milliseconds(TICK_MS);
+    epoll_event events[SERVER_EVENTS];
+    SteadyTime next = SteadyClock::now() + tick;
 
-        if (collision() == 1)
+    for (;;)
+    {
+        long long waitMs = chrono::duration_cast<chrono::milliseconds>(next - SteadyClock::now() + chrono::microseconds(999)).count();
+        int n = epoll_wait(w.epfd, events, SERVER_EVENTS, (int)max(0LL, waitMs));
+        for (int i = 0; i < n; i++)
         {
-            gameover();
+            Session *s = (Session *)events[i].data.ptr;
+            if (s == NULL)
+            {
+                serverAccept(w);
+                continue;
+            }
+            bool ok = (events[i].events & (EPOLLERR | EPOLLHUP)) == 0;
+            if (ok && (events[i].events & EPOLLIN))
+                ok = sessionRead(*s);
+            if (ok && (events[i].events & EPOLLOUT))
+                ok = sessionFlush(w, *s);
+            if (!ok)
+                sessionClose(w, s);
+        }
 
-            return;
+        SteadyTime now = SteadyClock::now();
+        if (now < next)
+            continue;
+        serverTick(w);
+        SteadyTime done = SteadyClock::now();
+        long long ns = chrono::duration_cast<chrono::nanoseconds>(done - now).count();
+        if (ns > w.slowestTickNs.load(memory_order_relaxed))
+            w.slowestTickNs.store(ns, memory_order_relaxed);
+        next += tick;
+        if (done >= next)
+        {
+            // Same policy as play(): drop the backlog rather than spiral.
+            w.lateTicks.fetch_add(1, memory_order_relaxed);
+            next = done + tick;
+        }
+    }
+}
+
+int runServer()
+{
+    raiseFileLimit();
+    // Every worker copies the background; build it before they start.
+    buildBackground();
+
+    int workerCount = options.workers > 0 ? options.workers : max(1, (int)thread::hardware_concurrency());
+    vector<ServerWorker> workers(workerCount);
+    for (ServerWorker &w : workers)
+    {
+        w.listenFd = serverListen(options.servePort, true);
+        w.epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (w.listenFd < 0 || w.epfd < 0)
+        {
+            perror("--serve");
+            return 1;
         }
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        epoll_ctl(w.epfd, EPOLL_CTL_ADD, w.listenFd, &ev);
+    }
+    vector<thread> threads;
+    for (ServerWorker &w : workers)
+        threads.push_back(thread(serverWorkerMain, ref(w)));
+    printf("serving on 127.0.0.1:%d with %d workers\n", options.servePort, workerCount);
+    fflush(stdout);
 
-        Sleep(50);
-        eraseCar();
-        eraseEnemy(0);
-        eraseEnemy(1);
+    // Workers run until the process is killed; this thread reports.
+    for (;;)
+    {
+        this_thread::sleep_for(chrono::seconds(SERVER_REPORT_SECONDS));
+        int live = 0;
+        long long frames = 0, bytes = 0, skipped = 0, late = 0, slowest = 0;
+        for (ServerWorker &w : workers)
+        {
+            live += w.live.load(memory_order_relaxed);
+            frames += w.frames.exchange(0, memory_order_relaxed);
+            bytes += w.bytes.exchange(0, memory_order_relaxed);
+            skipped += w.skipped.exchange(0, memory_order_relaxed);
+            late += w.lateTicks.exchange(0, memory_order_relaxed);
+            slowest = max(slowest, w.slowestTickNs.exchange(0, memory_order_relaxed));
+        }
+        printf("%d sessions, %.0f frames/s, %.2f MB/s, %lld frames held back, slowest tick %.1f ms, %lld late ticks\n", live,
+               (double)frames / SERVER_REPORT_SECONDS, bytes / 1e6 / SERVER_REPORT_SECONDS, skipped, slowest / 1e6, late);
+        fflush(stdout);
+    }
+}
 
-        if (enemyY[0] == 10)
-            if (enemyFlag[1] == 0)
-                enemyFlag[1] = 1;
+// --bot: opens the connections, presses 'a' or 'd' on each about every
+// BOT_KEY_TICKS ticks, and counts what comes back each second.
+int runBots()
+{
+    raiseFileLimit();
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    vector<int> fds;
+    sockaddr_in addr = loopbackAddress(options.botPort);
+    for (int i = 0; i < options.bots; i++)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 || (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS))
+        {
+            perror("--bot");
+            return 1;
+        }
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = (uint32_t)fds.size();
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        fds.push_back(fd);
+    }
 
-        if (enemyFlag[0] == 1)
-            enemyY[0] += 1;
+    Rng rng;
+    rngSeed(rng, options.haveSeed ? options.seed : freshSeed());
+    const SteadyClock::duration tick = chrono::milliseconds(TICK_MS);
+    SteadyTime start = SteadyClock::now();
+    SteadyTime end = start + chrono::seconds(options.botSeconds);
+    SteadyTime nextTick = start + tick;
+    SteadyTime nextReport = start + chrono::seconds(1);
+    vector<epoll_event> events(SERVER_EVENTS);
+    char buf[16384];
+    int open = options.bots;
+    long long bytes = 0, total = 0;
 
-        if (enemyFlag[1] == 1)
-            enemyFlag[1] += 1;
+    while (SteadyClock::now() < end)
+    {
+        long long waitMs = chrono::duration_cast<chrono::milliseconds>(nextTick - SteadyClock::now()).count();
+        int n = epoll_wait(epfd, events.data(), (int)events.size(), (int)max(0LL, waitMs));
+        for (int i = 0; i < n; i++)
+        {
+            int &fd = fds[events[i].data.u32];
+            ssize_t got;
+            while ((got = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+                bytes += got;
+            if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            {
+                close(fd);
+                fd = -1;
+                open--;
+            }
+        }
 
-        if (enemyY[0] > SCREEN_HEIGHT - 4)
+        SteadyTime now = SteadyClock::now();
+        if (now >= nextTick)
         {
-            resetEnemy(0);
-            score++;
-            updateScore();
+            for (int fd : fds)
+            {
+                if (fd >= 0 && rngBounded(rng, BOT_KEY_TICKS) == 0)
+                {
+                    char key = rngBounded(rng, 2) ? 'a' : 'd';
+                    ssize_t ignored = send(fd, &key, 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+                    (void)ignored;
+                }
+            }
+            nextTick += tick;
+            if (nextTick < now)
+                nextTick = now + tick;
         }
-        if (enemyY[1] > SCREEN_HEIGHT - 4)
+        if (now >= nextReport)
         {
-            resetEnemy(1);
-            score++;
-            updateScore();
+            printf("%d/%d bots connected, %.2f MB/s received\n", open, options.bots, bytes / 1e6);
+            fflush(stdout);
+            total += bytes;
+            bytes = 0;
+            nextReport += chrono::seconds(1);
         }
     }
+    total += bytes;
+    double seconds = chrono::duration<double>(SteadyClock::now() - start).count();
+    printf("%d bots for %.1fs: %.0f bytes per bot per second\n", options.bots, seconds, total / seconds / options.bots);
+    for (int fd : fds)
+        if (fd >= 0)
+            close(fd);
+    close(epfd);
+    return 0;
+}
+
+#else
+
+int runServer()
+{
+    fprintf(stderr, "--serve needs Linux (epoll)\n");
+    return 1;
 }
 
-int main()
+int runBots()
 {
-    setcursor(0, 0);
-    srand((unsigned)time(NULL));
+    fprintf(stderr, "--bot needs Linux (epoll)\n");
+    return 1;
+}
+
+#endif
+
+int main(int argc, char **argv)
+{
+    ios::sync_with_stdio(false);
+    if (!parseOptions(argc, argv))
+        return 1;
+
+    if (options.benchCollision)
+    {
+        benchCollision();
+        return 0;
+    }
+    if (options.bench)
+        return runBenchmarks();
+    if (options.selfTest)
+        return runSelfTest();
+    if (options.simGames > 0)
+        return runMonteCarlo();
+    if (options.servePort > 0)
+        return runServer();
+    if (options.botPort > 0)
+        return runBots();
+
+    ReplayPlayer replay;
+    if (options.replayPath != NULL && !replayOpen(replay, options.replayPath))
+        return 1;
+
+    if (options.stats)
+        atexit(dumpProfile);
+    if (options.replayPath == NULL)
+        scoreOpen(scores, options.scoresPath);
+    if (options.castPort > 0 && !castStart(options.castPort))
+    {
+        perror("--broadcast");
+        return 1;
+    }
+    termOpen();
+    atexit(termClose);
+    atexit(castStop);
+    setcursor(0);
+
+    if (options.replayPath != NULL)
+    {
+        watchReplay(replay);
+        replayClose(replay);
+        return 0;
+    }
+    if (options.autopilot)
+    {
+        while (!play())
+            ;
+        return 0;
+    }
 
     do
     {
-        system("cls");
+        clearScreen();
         gotoxy(10, 5);
         cout << " --------------------";
         gotoxy(10, 6);
@@ -295,10 +5487,11 @@ int main()
         cout << "2. Start Game";
         gotoxy(10, 10);
         cout << "3. Quit";
+        drawLeaderboard(10, 15);
         gotoxy(10, 12);
         cout << "Select Option: ";
 
-        char op = getche();
+        char op = readKeyEcho();
 
         if (op == '1')
             instructions();
@@ -308,6 +5501,6 @@ int main()
             exit(0);
     } while (1);
 
-    getch();
+    readKey();
     return 0;
 }